@@ -3,11 +3,69 @@
 
 #include <xt_seng_genl.h>
 #include <stdint.h>
+#include <stddef.h>
+#include <netinet/in.h> //in6_addr
+
+/**
+ * @brief one enclave of a batch
+ *
+ * Used by add_enclaves_batch().
+ * */
+struct seng_enclave_entry {
+    uint32_t enclave_ip;        ///< the enclave (network byte order)
+    const uint8_t* app_hash;    ///< the app hash associated with the enclave
+    uint32_t host;              ///< the host ip associated with the enclave
+    const char* cat_name;       ///< a category associated with the app (optional, may be NULL)
+};
+
+/**
+ * @brief how conntrack entries of removed enclaves are deleted
+ *
+ * See set_conntrack_flush_mode().
+ * */
+enum seng_ct_flush_mode {
+    SENG_CT_FLUSH_KERNEL,   ///< the kernel module deletes them as part of the removal message (default)
+    SENG_CT_FLUSH_USER,     ///< the library dumps the conntrack table and deletes them via libnetfilter_conntrack
+};
+
+/**
+ * @brief one enclave of a dump
+ *
+ * Passed to the callback of dump_enclaves(). Only valid during the callback.
+ * */
+struct seng_enclave_info {
+    int family;                                     ///< address family of the enclave (AF_INET or AF_INET6)
+    uint32_t enclave_ip;                            ///< the enclave (network byte order, AF_INET)
+    struct in6_addr enclave_ip6;                    ///< the enclave (AF_INET6)
+    uint8_t app_hash[SGX_HASH_SIZE];                ///< the app hash associated with the enclave
+    uint32_t host;                                  ///< the host ip associated with the enclave (AF_INET)
+    struct in6_addr host6;                          ///< the host ip associated with the enclave (AF_INET6)
+    size_t n_cats;                                  ///< amount of categories of the app
+    const char* cat_names[SENG_MAX_CATEGORIES];     ///< the categories of the app
+};
+
+/**
+ * @brief callback of dump_enclaves()
+ *
+ * @param[in] info  the dumped enclave
+ * @param[in] arg   the argument passed to dump_enclaves()
+ *
+ * @return 0 to continue, any other value stops the iteration
+ * */
+typedef int (*seng_dump_cb)(const struct seng_enclave_info* info, void* arg);
 
 /**
  * @brief Prepares the netlink socket.
  *
  * Prepares the netlink socket nlsock and sets the callback functions cb to process_msg() and seq_check().
+ * Resolves the generic netlink family id of the kernel module, which is cached for all further messages
+ * and only re-resolved if the module has been reloaded.
+ * Also opens the conntrack handles for the user-space conntrack deletion (see set_conntrack_flush_mode()).
+ * nlsock does not join the multicast group, events are received via seng_events_open().
+ *
+ * The library never switches privileges. The calling process must hold CAP_NET_ADMIN in its effective set
+ * for all changes of the SENG module database, for deleting conntrack entries, for dump_enclaves()
+ * and for seng_events_open().
  * 
  * @return EXIT_SUCCESS or error codes
 */
@@ -46,6 +104,21 @@ int flush_module (void);
  * */
 int add_enclave_ack (uint32_t enclave_ip, const uint8_t* app_hash, uint32_t host, const char* cat_name);
 
+/**
+ * @brief adds many enclaves in the kernel module
+ *
+ * Sends the enclaves in batch messages of up to SENG_BATCH_MAX_ENTRIES entries.
+ * The kernel module adds all entries of a message under a single acquisition of its database lock.
+ * Each message is all-or-nothing: if one of its entries fails (e.g., a duplicate enclave), none of its entries
+ * is added. Failed messages are not repeated, as their error (e.g., EEXIST) would not change.
+ *
+ * @param[in] entries       The enclaves to be added.
+ * @param[in] n             The amount of enclaves.
+ *
+ * @return EXIT_SUCCESS or the error code of the last failed message
+ * */
+int add_enclaves_batch (const struct seng_enclave_entry* entries, size_t n);
+
 /**
  * @brief tries to add a category in the given app
  *
@@ -73,6 +146,9 @@ int remove_cat_from_app_ack (const uint8_t* app_hash, const char* cat_name);
 /**
  * @brief removes an enclave
  *
+ * Also deletes all conntrack entries associated with the enclave to prevent the exploitation of stale entries
+ * on ip re-assignments (see set_conntrack_flush_mode()).
+ *
  * Will send the message up to 4 times, until it was successful.
  *
  * @param[in] enclave_ip     The enclave to be removed.
@@ -81,4 +157,429 @@ int remove_cat_from_app_ack (const uint8_t* app_hash, const char* cat_name);
  * */
 int remove_enclave_ack (uint32_t enclave_ip);
 
+/**
+ * @brief tries to add an ipv6 enclave in the kernel module
+ *
+ * IPv6 enclaves are matched by ip6tables rules. Subnet mode and batches only cover ipv4 enclaves.
+ * Will send the message up to 4 times, until it was successful.
+ *
+ * @param[in] enclave_ip    The enclave to be added.
+ * @param[in] app_hash      The app hash associated with the enclave.
+ * @param[in] host          The host ip associated with the enclave. (v4-mapped for ipv4 hosts)
+ * @param[in] cat_name      A category associated with the app. (optional)
+ *
+ * @return EXIT_SUCCESS or error codes
+ * */
+int add_enclave6_ack (const struct in6_addr* enclave_ip, const uint8_t* app_hash, const struct in6_addr* host, const char* cat_name);
+
+/**
+ * @brief removes an ipv6 enclave
+ *
+ * The conntrack entries of the enclave are always deleted by the kernel module, regardless of set_conntrack_flush_mode().
+ * Will send the message up to 4 times, until it was successful.
+ *
+ * @param[in] enclave_ip     The enclave to be removed.
+ *
+ * @return EXIT_SUCCESS or error codes
+ * */
+int remove_enclave6_ack (const struct in6_addr* enclave_ip);
+
+/**
+ * @brief selects how conntrack entries of removed enclaves are deleted
+ *
+ * By default, the kernel module deletes them while handling the removal message, i.e., a removal is a single
+ * netlink round trip without dumping the conntrack table to user space.
+ * SENG_CT_FLUSH_USER restores the user-space deletion, e.g., for kernel modules without support for it.
+ *
+ * @param[in] mode   The flush mode.
+ *
+ * @return EXIT_SUCCESS or EXIT_FAILURE for unknown modes
+ * */
+int set_conntrack_flush_mode (enum seng_ct_flush_mode mode);
+
+/**
+ * @brief deletes the conntrack entries of many removed enclaves from user space
+ *
+ * Deletes all ipv4 conntrack entries with one of the given enclaves as source or destination
+ * in a single pass over the conntrack table, e.g., after removing several enclaves in SENG_CT_FLUSH_USER mode.
+ *
+ * @param[in] enclave_ips   The removed enclaves. (network byte order)
+ * @param[in] n             The amount of enclaves.
+ *
+ * @return amount of deleted entries or -1 on error
+ * */
+int delete_conntrack_entries_batch (const uint32_t* enclave_ips, size_t n);
+
+/**
+ * @brief iterates over all enclaves of the kernel module
+ *
+ * Streams the active database of the kernel module (multi-part netlink dump) and calls cb once per enclave,
+ * so that the SENG Server can compare it against its own state and only resync the changed entries.
+ * Requires CAP_NET_ADMIN.
+ *
+ * @param[in] cb    The callback.
+ * @param[in] arg   The argument passed to cb.
+ *
+ * @return 0 after all enclaves, the non-zero return value of cb, or a negative libnl error code
+ * (-NLE_DUMP_INTR if the database changed during the dump, i.e., the dump should be repeated,
+ * -NLE_MSGSIZE if an enclave has too many categories to fit into a single part of the dump)
+ * */
+int dump_enclaves (seng_dump_cb cb, void* arg);
+
+/**
+ * @brief enables subnet mode in the kernel module
+ *
+ * In subnet mode, the module resolves enclave ips by directly indexing an array covering the enclave subnet.
+ * Lookups of ips outside of the subnet are rejected without hashing.
+ * Fails if an already registered enclave is outside of the subnet. Afterwards, enclaves outside of the subnet are rejected.
+ * Calling it again replaces the subnet.
+ *
+ * Will send the message up to 4 times, until it was successful.
+ *
+ * @param[in] subnet         The enclave subnet base address. (network byte order)
+ * @param[in] prefix_len     The enclave subnet prefix length (SENG_SUBNET_MIN_PREFIX to 32).
+ *
+ * @return EXIT_SUCCESS or error codes
+ * */
+int set_enclave_subnet_ack (uint32_t subnet, uint32_t prefix_len);
+
+/**
+ * @brief disables subnet mode in the kernel module
+ *
+ * The module falls back to the enclave hash table for all lookups.
+ *
+ * Will send the message up to 4 times, until it was successful.
+ *
+ * @return EXIT_SUCCESS or error codes
+ * */
+int clear_enclave_subnet_ack (void);
+
+/**
+ * @brief sets the policy of an app in the policy map
+ *
+ * The policy map is applied by a single SENGMAP rule (e.g., `iptables -A FORWARD -j SENGMAP --default drop`),
+ * which looks up the policy of the enclave's app with a single hash lookup instead of walking one rule per app.
+ * The entry of an app takes precedence over the entries of its categories. Replaces an existing entry.
+ * The policy map is independent of the enclaves and survives flushes and staged resyncs of the database.
+ *
+ * Will send the message up to 4 times, until it was successful.
+ *
+ * @param[in] app_hash        The app hash.
+ * @param[in] verdict         The verdict applied to the packets of the app.
+ * @param[in] mark            The packet mark set by the SENGMAP target, also the value written by the SENGMARK target (or NULL to keep the mark).
+ *
+ * @return EXIT_SUCCESS or error codes
+ * */
+int set_app_policy_ack (const uint8_t* app_hash, enum seng_policy_verdict verdict, const uint32_t* mark);
+
+/**
+ * @brief sets the policy of a category in the policy map
+ *
+ * Applies to the apps of the category without an own entry (see set_app_policy_ack()).
+ * If several categories of an app have an entry, the entry of the category with the lowest id in the kernel module applies.
+ * A category gets the lowest free id when it is first used (by an app, a seng rule or a policy entry) and releases it
+ * when it is no longer used, i.e., as long as the categories stay in use, the one used first takes precedence.
+ * Category entries of an app should therefore be disjoint.
+ *
+ * Will send the message up to 4 times, until it was successful.
+ *
+ * @param[in] cat_name        The category name.
+ * @param[in] verdict         The verdict applied to the packets of the category's apps.
+ * @param[in] mark            The packet mark set by the SENGMAP target, also the value written by the SENGMARK target (or NULL to keep the mark).
+ *
+ * @return EXIT_SUCCESS or error codes
+ * */
+int set_cat_policy_ack (const char* cat_name, enum seng_policy_verdict verdict, const uint32_t* mark);
+
+/**
+ * @brief removes the policy of an app from the policy map
+ *
+ * Will send the message up to 4 times, until it was successful.
+ *
+ * @param[in] app_hash        The app hash.
+ *
+ * @return EXIT_SUCCESS or error codes (e.g., if the app has no entry)
+ * */
+int remove_app_policy_ack (const uint8_t* app_hash);
+
+/**
+ * @brief removes the policy of a category from the policy map
+ *
+ * Will send the message up to 4 times, until it was successful.
+ *
+ * @param[in] cat_name        The category name.
+ *
+ * @return EXIT_SUCCESS or error codes (e.g., if the category has no entry)
+ * */
+int remove_cat_policy_ack (const char* cat_name);
+
+/**
+ * @brief removes all entries of the policy map
+ *
+ * Will send the message up to 4 times, until it was successful.
+ *
+ * @return EXIT_SUCCESS or error codes
+ * */
+int flush_policy_ack (void);
+
+/**
+ * @brief begins a staged database in the kernel module
+ *
+ * A full resync streams the complete set of enclaves, apps and categories into a staged database
+ * (stage_enclaves_batch(), stage_cat_to_app_ack()), while the rules keep matching against the active one.
+ * stage_commit_ack() then atomically replaces the active database, i.e., without the window of a flush
+ * in which legitimate enclave traffic would be dropped.
+ * Subnet mode is inherited from the active database. An unfinished staged database is discarded.
+ *
+ * Will send the message up to 4 times, until it was successful.
+ *
+ * @return EXIT_SUCCESS or error codes
+ * */
+int stage_begin_ack (void);
+
+/**
+ * @brief adds many enclaves to the staged database
+ *
+ * Same as add_enclaves_batch(), but targets the staged database (see stage_begin_ack()).
+ *
+ * @param[in] entries       The enclaves to be added.
+ * @param[in] n             The amount of enclaves.
+ *
+ * @return EXIT_SUCCESS or the error code of the last failed message
+ * */
+int stage_enclaves_batch (const struct seng_enclave_entry* entries, size_t n);
+
+/**
+ * @brief tries to add a category to an app of the staged database
+ *
+ * Same as cat_to_app_ack(), but targets the staged database (see stage_begin_ack()).
+ *
+ * @param[in] app_hash        The app hash to be added to.
+ * @param[in] cat_name        The category to be added.
+ *
+ * @return EXIT_SUCCESS or error codes
+ * */
+int stage_cat_to_app_ack (const uint8_t* app_hash, const char* cat_name);
+
+/**
+ * @brief replaces the active database by the staged one
+ *
+ * The kernel module publishes the staged database with a single pointer swap
+ * and frees the old one once no packet can use it anymore.
+ * Conntrack entries of enclaves which are missing in the staged database, or associated with another app or host,
+ * are deleted by the kernel module (in both conntrack flush modes).
+ *
+ * Will send the message up to 4 times, until it was successful.
+ *
+ * @return EXIT_SUCCESS or error codes (e.g., if no database is staged)
+ * */
+int stage_commit_ack (void);
+
+/**
+ * @brief discards the staged database
+ *
+ * Will send the message up to 4 times, until it was successful.
+ *
+ * @return EXIT_SUCCESS or error codes
+ * */
+int stage_abort_ack (void);
+
+/**
+ * @brief completion callback of the asynchronous API
+ *
+ * Called from seng_async_process() once per completed operation, in submission order.
+ *
+ * @param[in] seq   The sequence number returned on submission.
+ * @param[in] err   0 on success, -ENOBUFS if the ACK was lost (outcome unknown), else the negative errno reported by the kernel module.
+ * @param[in] arg   The argument passed to seng_async_open().
+ * */
+typedef void (*seng_async_cb)(uint32_t seq, int err, void* arg);
+
+/**
+ * @brief opens the asynchronous socket
+ *
+ * The asynchronous API pipelines operations: every seng_async_*() submission sends its message with NLM_F_ACK
+ * on a separate non-blocking socket and returns its sequence number without waiting.
+ * The caller adds seng_async_fd() to its event loop and calls seng_async_process() whenever it is readable.
+ * Failed operations are not repeated, the caller decides based on the reported errno.
+ * Requires prep_nl_sock(), which resolves the generic netlink family id.
+ *
+ * @param[in] cb    The completion callback. (optional)
+ * @param[in] arg   The argument passed to cb.
+ *
+ * @return EXIT_SUCCESS or error codes
+ * */
+int seng_async_open (seng_async_cb cb, void* arg);
+
+/**
+ * @brief closes the asynchronous socket
+ *
+ * Completions of operations still in flight are dropped.
+ *
+ * @return EXIT_SUCCESS or EXIT_FAILURE
+ * */
+int seng_async_close (void);
+
+/**
+ * @brief returns the file descriptor of the asynchronous socket for polling
+ *
+ * @return the file descriptor or -1 if not opened
+ * */
+int seng_async_fd (void);
+
+/**
+ * @brief returns the amount of submitted operations which have not completed yet
+ * */
+unsigned int seng_async_pending (void);
+
+/**
+ * @brief receives all available ACKs and calls the completion callback for each of them
+ *
+ * Never blocks.
+ *
+ * ACKs lost due to a full receive buffer complete their operations with -ENOBUFS, so that no operation stays pending.
+ *
+ * @return the amount of completed operations or a negative libnl error code
+ * (-NLE_NOMEM if ACKs were lost due to a full receive buffer)
+ * */
+int seng_async_process (void);
+
+/**
+ * @brief submits adding an enclave
+ *
+ * Submissions fail with -NLE_AGAIN if the send buffer is full; process completions and submit again.
+ *
+ * @param[in]  enclave_ip   The enclave to be added.
+ * @param[in]  app_hash     The app hash associated with the enclave.
+ * @param[in]  host         The host ip associated with the enclave.
+ * @param[in]  cat_name     A category associated with the app. (optional)
+ * @param[out] seq          The sequence number of the operation. (optional)
+ *
+ * @return EXIT_SUCCESS or error codes
+ * */
+int seng_async_add_enclave (uint32_t enclave_ip, const uint8_t* app_hash, uint32_t host, const char* cat_name, uint32_t* seq);
+
+/**
+ * @brief submits adding up to SENG_BATCH_MAX_ENTRIES enclaves in a single message
+ *
+ * All-or-nothing: if the operation fails, none of the enclaves has been added.
+ *
+ * @param[in]  entries   The enclaves to be added.
+ * @param[in]  n         The amount of enclaves.
+ * @param[out] seq       The sequence number of the operation. (optional)
+ *
+ * @return EXIT_SUCCESS or error codes
+ * */
+int seng_async_add_enclaves_batch (const struct seng_enclave_entry* entries, size_t n, uint32_t* seq);
+
+/**
+ * @brief submits adding a category to the given app
+ *
+ * @param[in]  app_hash   The app hash to be added to.
+ * @param[in]  cat_name   The category to be added.
+ * @param[out] seq        The sequence number of the operation. (optional)
+ *
+ * @return EXIT_SUCCESS or error codes
+ * */
+int seng_async_cat_to_app (const uint8_t* app_hash, const char* cat_name, uint32_t* seq);
+
+/**
+ * @brief submits removing a category from the given app
+ *
+ * @param[in]  app_hash   The app hash to be removed from.
+ * @param[in]  cat_name   The category to be removed.
+ * @param[out] seq        The sequence number of the operation. (optional)
+ *
+ * @return EXIT_SUCCESS or error codes
+ * */
+int seng_async_remove_cat_from_app (const uint8_t* app_hash, const char* cat_name, uint32_t* seq);
+
+/**
+ * @brief submits removing an enclave
+ *
+ * The conntrack entries of the enclave are deleted as well (see set_conntrack_flush_mode()).
+ * In SENG_CT_FLUSH_USER mode, seng_async_process() deletes them once the removal has been acknowledged
+ * (or its ACK was lost).
+ *
+ * @param[in]  enclave_ip   The enclave to be removed.
+ * @param[out] seq          The sequence number of the operation. (optional)
+ *
+ * @return EXIT_SUCCESS or error codes
+ * */
+int seng_async_remove_enclave (uint32_t enclave_ip, uint32_t* seq);
+
+/**
+ * @brief one change of the active database of the kernel module
+ *
+ * Passed to the callback of seng_events_open(). Only valid during the callback.
+ * Fields not carried by the event type are 0 or NULL (see @link seng_event_type @endlink).
+ * */
+struct seng_event {
+    enum seng_event_type type;  ///< the kind of change
+    uint32_t enclave_ip;        ///< the added or removed ipv4 enclave (network byte order)
+    const struct in6_addr* enclave_ip6; ///< the added or removed ipv6 enclave
+    const uint8_t* app_hash;    ///< the app hash of the added enclave or changed app
+    uint32_t host;              ///< the host ip associated with the added ipv4 enclave
+    const struct in6_addr* host6; ///< the host ip associated with the added ipv6 enclave
+    const char* cat_name;       ///< the added or removed category
+    uint32_t subnet;            ///< the enclave subnet base address
+    uint32_t prefix_len;        ///< the enclave subnet prefix length
+};
+
+/**
+ * @brief event callback of the subscriber API
+ *
+ * Called from seng_events_process() once per event, in the order of the changes.
+ *
+ * @param[in] ev    The event.
+ * @param[in] arg   The argument passed to seng_events_open().
+ * */
+typedef void (*seng_event_cb)(const struct seng_event* ev, void* arg);
+
+/**
+ * @brief subscribes to the events of the kernel module
+ *
+ * The kernel module multicasts every change of the active database (enclaves, categories, subnet mode, flushes
+ * and the commit of a staged database) to its multicast group, as long as anyone is subscribed.
+ * Mirrors (e.g., monitors or a standby server) subscribe first, then take a snapshot with dump_enclaves()
+ * and apply the events afterwards. Events are best effort: if seng_events_process() reports lost events
+ * or a SENG_EVENT_SWAP is received, the mirror has to take a new snapshot.
+ * Independent of prep_nl_sock() and of the other sockets of the library.
+ *
+ * The events carry the enclave ips, app hashes, host ips and categories, i.e., as much as dump_enclaves().
+ * Joining the group therefore requires CAP_NET_ADMIN. Kernels from 5.8 until the introduction of
+ * GENL_MCAST_CAP_NET_ADMIN (6.7 and its stable backports) cannot restrict multicast groups: there,
+ * any local user can subscribe and read the database.
+ *
+ * @param[in] cb    The event callback.
+ * @param[in] arg   The argument passed to cb.
+ *
+ * @return EXIT_SUCCESS or error codes
+ * */
+int seng_events_open (seng_event_cb cb, void* arg);
+
+/**
+ * @brief unsubscribes from the events of the kernel module
+ *
+ * @return EXIT_SUCCESS or EXIT_FAILURE
+ * */
+int seng_events_close (void);
+
+/**
+ * @brief returns the file descriptor of the event socket for polling
+ *
+ * @return the file descriptor or -1 if not subscribed
+ * */
+int seng_events_fd (void);
+
+/**
+ * @brief receives all available events and calls the event callback for each of them
+ *
+ * Never blocks.
+ *
+ * @return the amount of received events or a negative libnl error code
+ * (-NLE_NOMEM if events were lost due to a full receive buffer)
+ * */
+int seng_events_process (void);
+
 #endif
@@ -3,12 +3,6 @@
 
 #include <linux/netfilter.h>
 
-/**
- * @def DEBUG_SENGMOD
- * @brief enables debugging prints to dmesg
- * */
-#define DEBUG_SENGMOD
-
 /**
  * @mainpage General
  *
@@ -40,7 +34,7 @@
  *
  * These flag are used in by @link seng_mt_info @endlink, to indicate the content of the rule created by ip_tables, that is then passed to the kernel module.
  *
- * Uses 7 bits.
+ * Uses 12 bits.
  * */
 enum flags {
     XT_SENG_APP_SRC       = 1 << 0, ///< rule has source app hash set
@@ -57,6 +51,8 @@ enum flags {
     XT_SENG_HOST_DST_INV  = 1 << 11, ///< destination host ip inverter
 };
 
+struct seng_mt_prog;
+
 /**
  * @brief rule info
  *
@@ -74,6 +70,56 @@ struct seng_mt_info {
     union nf_inet_addr dst_subnet;                 ///< destination subnet
 
     uint16_t flags;                                 ///< flags that indicate, which info is contained in this struct
+
+    /* kernel-internal, filled in by the kernel module when the rule is checked */
+    union {
+        struct seng_mt_prog *prog;                  ///< precompiled rule program
+        uint64_t prog_slot;                         ///< fixes the slot to 64 bits, so that 32 bit user spaces (compat) share the layout
+    } __attribute__((aligned(8)));
+};
+
+/**
+ * @brief flags of the SENGMAP target
+ * */
+enum seng_map_flags {
+    XT_SENG_MAP_DST       = 1 << 0, ///< looks up the destination enclave instead of the source enclave
+};
+
+/**
+ * @brief target info of the SENGMAP target
+ *
+ * The target resolves the enclave of the packet and applies the verdict (and mark) of its entry in the policy map
+ * of the kernel module, i.e., a single rule dispatches the policy of all apps.
+ * */
+struct seng_map_tginfo {
+    uint8_t flags;                                  ///< see enum seng_map_flags
+    uint8_t verdict;                                ///< verdict of packets without policy map entry (enum seng_policy_verdict)
+};
+
+/**
+ * @brief flags of the SENGMARK target
+ * */
+enum seng_mark_flags {
+    XT_SENG_MARK_DST      = 1 << 0, ///< looks up the destination enclave instead of the source enclave
+    XT_SENG_MARK_CT       = 1 << 1, ///< writes the conntrack mark of the flow instead of the packet mark
+};
+
+/**
+ * @def XT_SENG_MARK_RESOLVED
+ * @brief default conntrack mark bit flagging the flows resolved by a SENGMARK --ctmark rule
+ * */
+#define XT_SENG_MARK_RESOLVED 0x80000000U
+
+/**
+ * @brief target info of the SENGMARK target
+ *
+ * The target resolves the enclave of the packet and writes the mark of its policy map entry
+ * into the masked bits of the packet mark or the conntrack mark.
+ * */
+struct seng_mark_tginfo {
+    uint32_t mask;                                  ///< the written bits of the mark
+    uint32_t resolved;                              ///< XT_SENG_MARK_CT: the conntrack mark bit flagging resolved flows (outside of mask), else 0
+    uint8_t flags;                                  ///< see enum seng_mark_flags
 };
 
 #endif
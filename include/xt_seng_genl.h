@@ -30,15 +30,41 @@
 #define SGX_HASH_SIZE 32 // TODO: use sgx header
 #define MAX_CAT_NAME_LENGTH (20 + 1)
 
+/**
+ * @def SENG_SUBNET_MIN_PREFIX
+ * @brief minimum prefix length of the enclave subnet in subnet mode
+ *
+ * Bounds the size of the direct-indexed enclave array to 2^16 entries.
+ * */
+#define SENG_SUBNET_MIN_PREFIX 16
 
 /**
- * @brief used to define different message types for different callback functions etc.
+ * @def SENG_BATCH_MAX_ENTRIES
+ * @brief maximum amount of enclave entries per batch message
+ *
+ * Keeps batch messages well below the default netlink socket buffer size.
+ * The kernel module rejects larger batches (E2BIG).
+ * */
+#define SENG_BATCH_MAX_ENTRIES 128
+
+/**
+ * @def SENG_MAX_CATEGORIES
+ * @brief maximum amount of distinct categories
  *
- * Here we only use one.
+ * Bounds the interned category ids of the kernel module and thereby the size of the per-app category bitmaps,
+ * as well as the amount of categories per dumped enclave.
+ * */
+#define SENG_MAX_CATEGORIES 256
+
+
+/**
+ * @brief used to define different message types for different callback functions etc.
  * */
 enum {
     GENL_XT_SENG_UNSPEC,		///< must not use element 0
-    GENL_XT_SENG_MSG,           ///< normal message protocol
+    GENL_XT_SENG_MSG,           ///< normal message protocol (requires CAP_NET_ADMIN)
+    GENL_XT_SENG_DUMP,          ///< dump request (NLM_F_DUMP) - one reply per enclave of the active database (requires CAP_NET_ADMIN)
+    GENL_XT_SENG_EVENT,         ///< multicast on GENL_SENG_MCGRP0 - one change of the active database (XT_SENG_ATTR_EVENT, joining requires CAP_NET_ADMIN)
 };
 
 /**
@@ -57,17 +83,63 @@ enum genl_seng_attrs {
     XT_SENG_ATTR_ADD,           ///< operation add - will add given entry
     XT_SENG_ATTR_RMV,           ///< operation remove - will remove given entry
     XT_SENG_ATTR_FLUSH,         ///< signal - operation flush - will flush all enclave entries
+    XT_SENG_ATTR_SUBNET,        ///< contains enclave subnet base address - add enables, remove disables subnet mode
+    XT_SENG_ATTR_PREFIX,        ///< contains enclave subnet prefix length
+    XT_SENG_ATTR_BATCH,         ///< nested list of XT_SENG_ATTR_ENTRY - operation add - will add all given enclaves
+    XT_SENG_ATTR_ENTRY,         ///< nested enclave entry of a batch (XT_SENG_ATTR_ENC, _APP, _HOST and optional _CAT)
+    XT_SENG_ATTR_STAGE_BEGIN,   ///< signal - begins a new staged database (discards an unfinished one)
+    XT_SENG_ATTR_STAGE_COMMIT,  ///< signal - atomically replaces the active database by the staged one
+    XT_SENG_ATTR_STAGE_ABORT,   ///< signal - discards the staged database
+    XT_SENG_ATTR_STAGED,        ///< flag - the operation targets the staged instead of the active database
+    XT_SENG_ATTR_CATS,          ///< nested list of XT_SENG_ATTR_CAT - all categories of a dumped enclave
+    XT_SENG_ATTR_CT_FLUSH,      ///< flag - enclave removal also deletes all conntrack entries of the enclave in the kernel
+    XT_SENG_ATTR_EVENT,         ///< contains the @link seng_event_type event type @endlink of a GENL_XT_SENG_EVENT message
+    XT_SENG_ATTR_ENC6,          ///< contains ipv6 enclave identifier (16 bytes, used instead of XT_SENG_ATTR_ENC)
+    XT_SENG_ATTR_HOST6,         ///< contains ipv6 host identifier (16 bytes, v4-mapped for ipv4 hosts) of an ipv6 enclave
+    XT_SENG_ATTR_POLICY,        ///< flag - the operation targets the policy map (key XT_SENG_ATTR_APP or _CAT, add/remove/flush)
+    XT_SENG_ATTR_VERDICT,       ///< contains the @link seng_policy_verdict verdict @endlink of a policy map entry
+    XT_SENG_ATTR_MARK,          ///< contains the packet mark of a policy map entry (optional)
     __XT_SENG_ATTR__MAX,        ///< used to calculate amount of attributes
 };
 
 ///Total amount of generic netlink attributes
 #define XT_SENG_ATTR_MAX (__XT_SENG_ATTR__MAX - 1)
 
+/**
+ * @brief event types of GENL_XT_SENG_EVENT messages
+ *
+ * Each event carries the attributes of the change, in the same format as the request that caused it.
+ * Changes of a staged database are not multicast, its commit is announced by a single swap event.
+ * */
+enum seng_event_type {
+    SENG_EVENT_UNSPEC,          ///< unused - must not use element 0
+    SENG_EVENT_ENCLAVE_ADD,     ///< enclave added (XT_SENG_ATTR_ENC, _APP, _HOST and optional _CAT; _ENC6 and _HOST6 for ipv6)
+    SENG_EVENT_ENCLAVE_RMV,     ///< enclave removed (XT_SENG_ATTR_ENC or _ENC6)
+    SENG_EVENT_CAT_ADD,         ///< category added to an app (XT_SENG_ATTR_APP, _CAT)
+    SENG_EVENT_CAT_RMV,         ///< category removed from an app (XT_SENG_ATTR_APP, _CAT)
+    SENG_EVENT_SUBNET_SET,      ///< subnet mode enabled (XT_SENG_ATTR_SUBNET, _PREFIX)
+    SENG_EVENT_SUBNET_CLEAR,    ///< subnet mode disabled
+    SENG_EVENT_FLUSH,           ///< all enclaves removed
+    SENG_EVENT_SWAP,            ///< the staged database replaced the active one - mirrors have to dump it again
+};
+
+/**
+ * @brief verdicts of the policy map entries
+ *
+ * Applied by the SENGMAP target to packets whose enclave has an entry in the policy map.
+ * */
+enum seng_policy_verdict {
+    SENG_POLICY_CONTINUE,       ///< continue with the next rule
+    SENG_POLICY_ACCEPT,         ///< accept the packet
+    SENG_POLICY_DROP,           ///< drop the packet
+    __SENG_POLICY_MAX,          ///< amount of verdicts
+};
+
 /**
  * @brief defines all generic netlink multicast groups
  * */
 enum genl_seng_multicast_groups {
-    GENL_SENG_MCGRP0,   ///< the single multicast group in our case
+    GENL_SENG_MCGRP0,   ///< the single multicast group in our case - carries the GENL_XT_SENG_EVENT messages
 };
 
 #endif
@@ -0,0 +1,141 @@
+#include <xtables.h>
+#include <stdio.h>
+#include <getopt.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "xt_seng.h"
+#include "xt_seng_genl.h"
+
+/**
+ * @brief command-line options of the SENGMAP target
+ * */
+static const struct option seng_map_tg_opts[] = {
+    {.name = "dst", .has_arg = false, .val = '1'},      ///< looks up the destination enclave
+    {.name = "default", .has_arg = true, .val = '2'},   ///< verdict of packets without policy
+    {NULL},
+};
+
+/**
+ * @brief names of the policy verdicts
+ * */
+static const char *seng_map_verdicts[__SENG_POLICY_MAX] = {
+    [SENG_POLICY_CONTINUE] = "continue",
+    [SENG_POLICY_ACCEPT] = "accept",
+    [SENG_POLICY_DROP] = "drop",
+};
+
+/**
+ * @brief parses command-line input
+ *
+ * @param[in] c             the option value (see seng_map_tg_opts)
+ * @param[in] argv          the command-line arguments
+ * @param[in] invert        if the option is inverted (not supported)
+ * @param[in,out] flags     the options parsed so far
+ * @param[in] entry         pointer to the entry
+ * @param[in,out] target    target, containing what already has been parsed
+ *
+ * @return true if the function parsed something correctly, false otherwise
+ * */
+static int seng_map_tg_parse(int c, char **argv, int invert, unsigned int *flags, const void *entry, struct xt_entry_target **target) {
+    struct seng_map_tginfo *info = (void *)(*target)->data;
+    int i;
+
+    if (invert)
+        xtables_error(PARAMETER_PROBLEM, "SENGMAP: Options cannot be inverted.");
+
+    switch (c) {
+        case '1': /* --dst */
+            info->flags |= XT_SENG_MAP_DST;
+            return true;
+
+        case '2': /* --default */
+            for (i = 0; i < __SENG_POLICY_MAX; i++) {
+                if (strcasecmp(optarg, seng_map_verdicts[i]) == 0) {
+                    info->verdict = i;
+                    return true;
+                }
+            }
+            xtables_error(PARAMETER_PROBLEM, "SENGMAP: Unknown verdict \"%s\"!", optarg);
+    }
+    return false;
+}
+
+/**
+ * @brief prints out the target in human-readable form
+ *
+ * @param[in] entry     pointer to the entry (e.g. of type ipt_entry)
+ * @param[in] target    contains the actual target to be printed
+ * @param[in] numeric   print numeric values only
+ * */
+static void seng_map_tg_print(const void *entry, const struct xt_entry_target *target, int numeric) {
+    const struct seng_map_tginfo *info = (const void *) target->data;
+
+    printf(" SENGMAP %s default %s", info->flags & XT_SENG_MAP_DST ? "dst" : "src", seng_map_verdicts[info->verdict % __SENG_POLICY_MAX]);
+}
+
+/**
+ * @brief saves the target in parsable form
+ *
+ * @param[in] entry     pointer to the entry (e.g. of type ipt_entry)
+ * @param[in] target    contains the actual target to be saved
+ * */
+static void seng_map_tg_save(const void *entry, const struct xt_entry_target *target) {
+    const struct seng_map_tginfo *info = (const void *) target->data;
+
+    if (info->flags & XT_SENG_MAP_DST) printf(" --dst");
+    if (info->verdict != SENG_POLICY_CONTINUE) printf(" --default %s", seng_map_verdicts[info->verdict % __SENG_POLICY_MAX]);
+}
+
+/**
+ * @brief prints usage info
+ * */
+static void seng_map_tg_help(void) {
+    printf(
+            "    SENGMAP target options:\n"
+            "    --dst                      Apply the policy of the dst enclave (default: src enclave)\n"
+            "    --default <verdict>        Verdict of packets without policy: continue (default), accept or drop\n"
+            "\n"
+            "    The policy map is populated via the SENG netfilter library (set_app_policy_ack()).\n"
+            "\n"
+    );
+}
+
+/**
+ * @brief structs to register against ip_tables/ip6tables/x_tables
+ * */
+static struct xtables_target seng_map_tg_reg[] = {
+    {
+        .version = XTABLES_VERSION,                                 ///< x_tables version
+        .name = "SENGMAP",                                          ///< extension name
+        .revision = 0,                                              ///< extension version
+        .family = NFPROTO_IPV4,                                     ///< family (here: ipv4)
+        .size = XT_ALIGN(sizeof(struct seng_map_tginfo)),           ///< rule size in kernel module
+        .userspacesize = XT_ALIGN(sizeof(struct seng_map_tginfo)),  ///< rule size in user space
+        .help = seng_map_tg_help,                                   ///< function which prints out usage info
+        .parse = seng_map_tg_parse,                                 ///< function which parses command-line input
+        .print = seng_map_tg_print,                                 ///< function which prints out the target
+        .save = seng_map_tg_save,                                   ///< function that saves the target in parsable form to stdout
+        .extra_opts = seng_map_tg_opts,                             ///< pointer to list of additional command-line options
+    },
+    {
+        .version = XTABLES_VERSION,                                 ///< x_tables version
+        .name = "SENGMAP",                                          ///< extension name
+        .revision = 0,                                              ///< extension version
+        .family = NFPROTO_IPV6,                                     ///< family (here: ipv6)
+        .size = XT_ALIGN(sizeof(struct seng_map_tginfo)),           ///< rule size in kernel module
+        .userspacesize = XT_ALIGN(sizeof(struct seng_map_tginfo)),  ///< rule size in user space
+        .help = seng_map_tg_help,                                   ///< function which prints out usage info
+        .parse = seng_map_tg_parse,                                 ///< function which parses command-line input
+        .print = seng_map_tg_print,                                 ///< function which prints out the target
+        .save = seng_map_tg_save,                                   ///< function that saves the target in parsable form to stdout
+        .extra_opts = seng_map_tg_opts,                             ///< pointer to list of additional command-line options
+    },
+};
+
+/**
+ * @brief registers the target library against ip_tables/ip6tables/x_tables
+ * */
+void _init(void) {
+    xtables_register_targets(seng_map_tg_reg, sizeof(seng_map_tg_reg) / sizeof(seng_map_tg_reg[0]));
+}
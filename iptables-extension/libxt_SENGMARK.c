@@ -0,0 +1,180 @@
+#include <xtables.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <getopt.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "xt_seng.h"
+
+/**
+ * @brief command-line options of the SENGMARK target
+ * */
+static const struct option seng_mark_tg_opts[] = {
+    {.name = "dst", .has_arg = false, .val = '1'},      ///< looks up the destination enclave
+    {.name = "ctmark", .has_arg = false, .val = '2'},   ///< writes the conntrack mark
+    {.name = "mask", .has_arg = true, .val = '3'},      ///< the written bits of the mark
+    {.name = "resolved", .has_arg = true, .val = '4'},  ///< the conntrack mark bit flagging resolved flows
+    {NULL},
+};
+
+/**
+ * @brief options given on the command line
+ * */
+enum seng_mark_tg_given {
+    SENG_MARK_GIVEN_MASK      = 1 << 0, ///< --mask
+};
+
+/**
+ * @brief initializes the target
+ *
+ * Writes the whole mark by default.
+ *
+ * @param[in] target      The target to be initialized.
+ * */
+static void seng_mark_tg_init(struct xt_entry_target *target) {
+    struct seng_mark_tginfo *info = (void *) target->data;
+
+    info->mask = UINT32_MAX;
+}
+
+/**
+ * @brief parses command-line input
+ *
+ * --ctmark claims the bit XT_SENG_MARK_RESOLVED (or --resolved) for flagging resolved flows,
+ * which the default mask then excludes.
+ *
+ * @param[in] c             the option value (see seng_mark_tg_opts)
+ * @param[in] argv          the command-line arguments
+ * @param[in] invert        if the option is inverted (not supported)
+ * @param[in,out] flags     the options parsed so far
+ * @param[in] entry         pointer to the entry
+ * @param[in,out] target    target, containing what already has been parsed
+ *
+ * @return true if the function parsed something correctly, false otherwise
+ * */
+static int seng_mark_tg_parse(int c, char **argv, int invert, unsigned int *flags, const void *entry, struct xt_entry_target **target) {
+    struct seng_mark_tginfo *info = (void *)(*target)->data;
+    unsigned int mask;
+
+    if (invert)
+        xtables_error(PARAMETER_PROBLEM, "SENGMARK: Options cannot be inverted.");
+
+    switch (c) {
+        case '1': /* --dst */
+            info->flags |= XT_SENG_MARK_DST;
+            break;
+
+        case '2': /* --ctmark */
+            info->flags |= XT_SENG_MARK_CT;
+            break;
+
+        case '3': /* --mask */
+            if (!xtables_strtoui(optarg, NULL, &mask, 1, UINT32_MAX))
+                xtables_error(PARAMETER_PROBLEM, "SENGMARK: Invalid mask \"%s\"!", optarg);
+            info->mask = mask;
+            *flags |= SENG_MARK_GIVEN_MASK;
+            break;
+
+        case '4': /* --resolved */
+            if (!xtables_strtoui(optarg, NULL, &mask, 1, UINT32_MAX) || (mask & (mask - 1)))
+                xtables_error(PARAMETER_PROBLEM, "SENGMARK: Invalid resolved bit \"%s\"!", optarg);
+            info->resolved = mask;
+            break;
+
+        default:
+            return false;
+    }
+
+    if (info->flags & XT_SENG_MARK_CT) {
+        if (!info->resolved) info->resolved = XT_SENG_MARK_RESOLVED;
+        if (!(*flags & SENG_MARK_GIVEN_MASK)) info->mask = ~info->resolved;
+    }
+    return true;
+}
+
+/**
+ * @brief prints out the target in human-readable form
+ *
+ * @param[in] entry     pointer to the entry (e.g. of type ipt_entry)
+ * @param[in] target    contains the actual target to be printed
+ * @param[in] numeric   print numeric values only
+ * */
+static void seng_mark_tg_print(const void *entry, const struct xt_entry_target *target, int numeric) {
+    const struct seng_mark_tginfo *info = (const void *) target->data;
+
+    printf(" SENGMARK %s %s mask 0x%x", info->flags & XT_SENG_MARK_DST ? "dst" : "src",
+           info->flags & XT_SENG_MARK_CT ? "ctmark" : "mark", info->mask);
+    if (info->flags & XT_SENG_MARK_CT) printf(" resolved 0x%x", info->resolved);
+}
+
+/**
+ * @brief saves the target in parsable form
+ *
+ * @param[in] entry     pointer to the entry (e.g. of type ipt_entry)
+ * @param[in] target    contains the actual target to be saved
+ * */
+static void seng_mark_tg_save(const void *entry, const struct xt_entry_target *target) {
+    const struct seng_mark_tginfo *info = (const void *) target->data;
+
+    if (info->flags & XT_SENG_MARK_DST) printf(" --dst");
+    if (info->flags & XT_SENG_MARK_CT) printf(" --ctmark --resolved 0x%x", info->resolved);
+    if (info->mask != UINT32_MAX) printf(" --mask 0x%x", info->mask);
+}
+
+/**
+ * @brief prints usage info
+ * */
+static void seng_mark_tg_help(void) {
+    printf(
+            "    SENGMARK target options:\n"
+            "    --dst                      Use the mark of the dst enclave's policy (default: src enclave)\n"
+            "    --ctmark                   Write the conntrack mark instead of the packet mark (resolved once per flow)\n"
+            "    --mask <mask>              Only write the given bits of the mark (default: 0xffffffff, without the resolved bit)\n"
+            "    --resolved <bit>           Conntrack mark bit flagging resolved flows, outside of the mask (default: 0x80000000)\n"
+            "\n"
+            "    The marks are set via the SENG netfilter library (set_app_policy_ack()).\n"
+            "\n"
+    );
+}
+
+/**
+ * @brief structs to register against ip_tables/ip6tables/x_tables
+ * */
+static struct xtables_target seng_mark_tg_reg[] = {
+    {
+        .version = XTABLES_VERSION,                                 ///< x_tables version
+        .name = "SENGMARK",                                         ///< extension name
+        .revision = 0,                                              ///< extension version
+        .family = NFPROTO_IPV4,                                     ///< family (here: ipv4)
+        .size = XT_ALIGN(sizeof(struct seng_mark_tginfo)),          ///< rule size in kernel module
+        .userspacesize = XT_ALIGN(sizeof(struct seng_mark_tginfo)), ///< rule size in user space
+        .help = seng_mark_tg_help,                                  ///< function which prints out usage info
+        .init = seng_mark_tg_init,                                  ///< function which initializes the target
+        .parse = seng_mark_tg_parse,                                ///< function which parses command-line input
+        .print = seng_mark_tg_print,                                ///< function which prints out the target
+        .save = seng_mark_tg_save,                                  ///< function that saves the target in parsable form to stdout
+        .extra_opts = seng_mark_tg_opts,                            ///< pointer to list of additional command-line options
+    },
+    {
+        .version = XTABLES_VERSION,                                 ///< x_tables version
+        .name = "SENGMARK",                                         ///< extension name
+        .revision = 0,                                              ///< extension version
+        .family = NFPROTO_IPV6,                                     ///< family (here: ipv6)
+        .size = XT_ALIGN(sizeof(struct seng_mark_tginfo)),          ///< rule size in kernel module
+        .userspacesize = XT_ALIGN(sizeof(struct seng_mark_tginfo)), ///< rule size in user space
+        .help = seng_mark_tg_help,                                  ///< function which prints out usage info
+        .init = seng_mark_tg_init,                                  ///< function which initializes the target
+        .parse = seng_mark_tg_parse,                                ///< function which parses command-line input
+        .print = seng_mark_tg_print,                                ///< function which prints out the target
+        .save = seng_mark_tg_save,                                  ///< function that saves the target in parsable form to stdout
+        .extra_opts = seng_mark_tg_opts,                            ///< pointer to list of additional command-line options
+    },
+};
+
+/**
+ * @brief registers the target library against ip_tables/ip6tables/x_tables
+ * */
+void _init(void) {
+    xtables_register_targets(seng_mark_tg_reg, sizeof(seng_mark_tg_reg) / sizeof(seng_mark_tg_reg[0]));
+}
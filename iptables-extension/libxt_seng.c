@@ -36,6 +36,43 @@ void seng_mt_init(struct xt_entry_match *match){
     //EMPTY
 }
 
+/**
+ * @brief saves a host ip in parsable form
+ *
+ * @param[in] opt       the option name
+ * @param[in] host      the host ip
+ * @param[in] mask      the host subnet mask
+ * @param[in] family    the family of the match (NFPROTO_IPV4 or NFPROTO_IPV6)
+ * */
+static void seng_save_host(const char *opt, const union nf_inet_addr *host, const union nf_inet_addr *mask, uint8_t family) {
+    if (family == NFPROTO_IPV6)
+        printf(" %s %s/%d ", opt, xtables_ip6addr_to_numeric(&host->in6), xtables_ip6mask_to_cidr(&mask->in6));
+    else
+        printf(" %s %s/%d ", opt, xtables_ipaddr_to_numeric(&host->in), xtables_ipmask_to_cidr(&mask->in));
+}
+
+/**
+ * @brief prints out a host ip in human-readable form
+ *
+ * @param[in] host      the host ip
+ * @param[in] mask      the host subnet mask
+ * @param[in] numeric   print numeric addresses only
+ * @param[in] family    the family of the match (NFPROTO_IPV4 or NFPROTO_IPV6)
+ * */
+static void seng_print_host(const union nf_inet_addr *host, const union nf_inet_addr *mask, int numeric, uint8_t family) {
+    if (family == NFPROTO_IPV6) {
+        if (numeric)
+            printf(" %s%s", xtables_ip6addr_to_numeric(&host->in6), xtables_ip6mask_to_numeric(&mask->in6));
+        else
+            printf(" %s%d", xtables_ip6addr_to_anyname(&host->in6), xtables_ip6mask_to_cidr(&mask->in6));
+    } else {
+        if (numeric)
+            printf(" %s%s", xtables_ipaddr_to_numeric(&host->in), xtables_ipmask_to_numeric(&mask->in));
+        else
+            printf(" %s%d", xtables_ipaddr_to_anyname(&host->in), xtables_ipmask_to_cidr(&mask->in));
+    }
+}
+
 /**
  * @brief saves the match in parsable form
  *
@@ -43,8 +80,9 @@ void seng_mt_init(struct xt_entry_match *match){
  *
  * @param[in] entry     pointer to the entry (e.g. of type ipt_entry)
  * @param[in] match     contains the actual match to be saved
+ * @param[in] family    the family of the match (NFPROTO_IPV4 or NFPROTO_IPV6)
  * */
-void seng_mt4_save(const void *entry, const struct xt_entry_match *match) {
+static void seng_mt_save(const void *entry, const struct xt_entry_match *match, uint8_t family) {
 	const struct seng_mt_info *info = (const void *)match->data;
 
 	if (info ->flags & XT_SENG_CAT_SRC) {
@@ -68,7 +106,7 @@ void seng_mt4_save(const void *entry, const struct xt_entry_match *match) {
         if (info->flags & XT_SENG_HOST_SRC_INV)
             printf("! ");
 
-        printf(" --src-host %s/%d ", xtables_ipaddr_to_numeric(&info->host_src.in), xtables_ipmask_to_cidr(&info->src_subnet.in));
+        seng_save_host("--src-host", &info->host_src, &info->src_subnet, family);
     }
 
     if (info ->flags & XT_SENG_CAT_DST) {
@@ -92,10 +130,20 @@ void seng_mt4_save(const void *entry, const struct xt_entry_match *match) {
         if (info->flags & XT_SENG_HOST_DST_INV)
             printf("! ");
 
-        printf(" --dst-host %s/%d ", xtables_ipaddr_to_numeric(&info->host_dst.in), xtables_ipmask_to_cidr(&info->dst_subnet.in));
+        seng_save_host("--dst-host", &info->host_dst, &info->dst_subnet, family);
     }
 }
 
+/// saves an ip_tables match (see seng_mt_save())
+void seng_mt4_save(const void *entry, const struct xt_entry_match *match) {
+    seng_mt_save(entry, match, NFPROTO_IPV4);
+}
+
+/// saves an ip6tables match (see seng_mt_save())
+void seng_mt6_save(const void *entry, const struct xt_entry_match *match) {
+    seng_mt_save(entry, match, NFPROTO_IPV6);
+}
+
 /**
  * @brief prints out the match
  *
@@ -104,8 +152,9 @@ void seng_mt4_save(const void *entry, const struct xt_entry_match *match) {
  * @param[in] entry     pointer to the entry (e.g. of type ipt_entry)
  * @param[in] match     contains the actual match to be saved
  * @param[in] numeric   some number
+ * @param[in] family    the family of the match (NFPROTO_IPV4 or NFPROTO_IPV6)
  * */
-void seng_mt4_print(const void *entry, const struct xt_entry_match *match, int numeric) {
+static void seng_mt_print(const void *entry, const struct xt_entry_match *match, int numeric, uint8_t family) {
 
 	const struct seng_mt_info *info = (const void *)match->data;
 
@@ -115,11 +164,7 @@ void seng_mt4_print(const void *entry, const struct xt_entry_match *match, int n
 		if (info->flags & XT_SENG_HOST_SRC_INV)
 			printf(" !");
 
-        if (numeric) {
-		    	printf(" %s%s", xtables_ipaddr_to_numeric(&info->host_src.in), xtables_ipmask_to_numeric(&info->src_subnet.in));
-        } else {
-		    	printf(" %s%d", xtables_ipaddr_to_anyname(&info->host_src.in), xtables_ipmask_to_cidr(&info->src_subnet.in));
-        }
+        seng_print_host(&info->host_src, &info->src_subnet, numeric, family);
 	}
 
     if (info ->flags & XT_SENG_CAT_SRC) {
@@ -149,11 +194,7 @@ void seng_mt4_print(const void *entry, const struct xt_entry_match *match, int n
         if (info->flags & XT_SENG_HOST_DST_INV)
             printf(" !");
 
-        if (numeric) {
-        	printf(" %s%s", xtables_ipaddr_to_numeric(&info->host_dst.in), xtables_ipmask_to_numeric(&info->dst_subnet.in));
-        } else {
-        	printf(" %s%d", xtables_ipaddr_to_anyname(&info->host_dst.in), xtables_ipmask_to_cidr(&info->dst_subnet.in));
-        }
+        seng_print_host(&info->host_dst, &info->dst_subnet, numeric, family);
     }
 
     if (info ->flags & XT_SENG_CAT_DST) {
@@ -179,6 +220,48 @@ void seng_mt4_print(const void *entry, const struct xt_entry_match *match, int n
 
 }
 
+/// prints out an ip_tables match (see seng_mt_print())
+void seng_mt4_print(const void *entry, const struct xt_entry_match *match, int numeric) {
+    seng_mt_print(entry, match, numeric, NFPROTO_IPV4);
+}
+
+/// prints out an ip6tables match (see seng_mt_print())
+void seng_mt6_print(const void *entry, const struct xt_entry_match *match, int numeric) {
+    seng_mt_print(entry, match, numeric, NFPROTO_IPV6);
+}
+
+/**
+ * @brief parses a host ip with optional subnet mask
+ *
+ * @param[in] arg       the command-line argument
+ * @param[out] host     the host ip
+ * @param[out] mask     the host subnet mask
+ * @param[in] family    the family of the match (NFPROTO_IPV4 or NFPROTO_IPV6)
+ * */
+static void seng_parse_host(const char *arg, union nf_inet_addr *host, union nf_inet_addr *mask, uint8_t family) {
+    struct in6_addr *addrs6, mask6;
+    struct in_addr *addrs, mask4;
+    unsigned int naddrs;
+
+    if (family == NFPROTO_IPV6) {
+        xtables_ip6parse_any(arg, &addrs6, &mask6, &naddrs);
+
+        if (addrs6 == NULL)
+            xtables_error(PARAMETER_PROBLEM, "Parse error at %s\n", arg);
+
+        memcpy(&host->in6, addrs6, sizeof(*addrs6));
+        memcpy(&mask->in6, &mask6, sizeof(mask6));
+    } else {
+        xtables_ipparse_any(arg, &addrs, &mask4, &naddrs);
+
+        if (addrs == NULL)
+            xtables_error(PARAMETER_PROBLEM, "Parse error at %s\n", arg);
+
+        memcpy(&host->in, addrs, sizeof(*addrs));
+        memcpy(&mask->in, &mask4, sizeof(mask4));
+    }
+}
+
 /**
  * @brief parses command-line input
  *
@@ -190,13 +273,12 @@ void seng_mt4_print(const void *entry, const struct xt_entry_match *match, int n
  * @param[in,out] flags     flags that have already been parsed
  * @param[in] entry         pointer to the entry
  * @param[in,out] match     match, containing what already has been parsed
+ * @param[in] family        the family of the match (NFPROTO_IPV4 or NFPROTO_IPV6)
  *
  * @return true if the function parsed something correctly, false otherwise
  * */
-int seng_mt4_parse(int c, char ** argv, int invert, unsigned int * flags, const void * entry, struct xt_entry_match ** match) {
+static int seng_mt_parse(int c, char ** argv, int invert, unsigned int * flags, const void * entry, struct xt_entry_match ** match, uint8_t family) {
 	struct seng_mt_info *info = (void *)(*match)->data;
-	struct in_addr *addrs, mask;
-	unsigned int naddrs;
 
 	switch (c) {
 		case '1': /* --src-cat */
@@ -256,14 +338,7 @@ int seng_mt4_parse(int c, char ** argv, int invert, unsigned int * flags, const
                 info->flags |= XT_SENG_HOST_SRC_INV;
             }
 
-            xtables_ipparse_any(optarg, &addrs, &mask, &naddrs);
-
-            if (addrs == NULL)
-                xtables_error(PARAMETER_PROBLEM, "Parse error at %s\n", optarg);
-
-            memcpy(&info->host_src.in, addrs, sizeof(*addrs));
-
-            memcpy(&info->src_subnet.in, &mask, sizeof(mask));
+            seng_parse_host(optarg, &info->host_src, &info->src_subnet, family);
 
             return true;
 
@@ -324,14 +399,7 @@ int seng_mt4_parse(int c, char ** argv, int invert, unsigned int * flags, const
                 info->flags |= XT_SENG_HOST_DST_INV;
             }
 
-            xtables_ipparse_any(optarg, &addrs, &mask, &naddrs);
-
-            if (addrs == NULL)
-                xtables_error(PARAMETER_PROBLEM, "Parse error at %s\n", optarg);
-
-            memcpy(&info->host_dst.in, addrs, sizeof(*addrs));
-
-            memcpy(&info->dst_subnet.in, &mask, sizeof(mask));
+            seng_parse_host(optarg, &info->host_dst, &info->dst_subnet, family);
 
             return true;
 
@@ -339,6 +407,16 @@ int seng_mt4_parse(int c, char ** argv, int invert, unsigned int * flags, const
 	return false;
 }
 
+/// parses the command-line input of an ip_tables match (see seng_mt_parse())
+int seng_mt4_parse(int c, char ** argv, int invert, unsigned int * flags, const void * entry, struct xt_entry_match ** match) {
+    return seng_mt_parse(c, argv, invert, flags, entry, match, NFPROTO_IPV4);
+}
+
+/// parses the command-line input of an ip6tables match (see seng_mt_parse())
+int seng_mt6_parse(int c, char ** argv, int invert, unsigned int * flags, const void * entry, struct xt_entry_match ** match) {
+    return seng_mt_parse(c, argv, invert, flags, entry, match, NFPROTO_IPV6);
+}
+
 /**
  * @brief final check
  *
@@ -374,26 +452,27 @@ void seng_mt_help(void) {
 			"    seng match options:\n"
 			"    [!] --src-cat  <name>      Match seng category name on src ip\n"
 			"    [!] --src-app  <hash>      Match seng app hash on src ip\n"
-            "    [!] --src-host <addr>      Match seng host ipv4 address on src ip\n"
+            "    [!] --src-host <addr>      Match seng host address (ipv4 or ipv6, per table family) on src ip\n"
             "    [!] --dst-cat  <name>      Match seng category name on dst ip\n"
             "    [!] --dst-app  <hash>      Match seng app hash on dst ip\n"
-            "    [!] --dst-host <addr>      Match seng host ipv4 address on dst ip\n"
+            "    [!] --dst-host <addr>      Match seng host address (ipv4 or ipv6, per table family) on dst ip\n"
             "\n"
     );
 }
 
 /**
- * @brief struct to register against ip_tables/x_tables
+ * @brief structs to register against ip_tables/ip6tables/x_tables
  *
- * This struct is used to register against ip_tables/x_tables.
+ * These structs are used to register against ip_tables and ip6tables.
  * */
-static struct xtables_match seng_mt_reg = {
+static struct xtables_match seng_mt_reg[] = {
+    {
         .version = XTABLES_VERSION,                                 ///< x_tables version
         .name = "seng",                                             ///< extension name
         .revision = 0,                                              ///< extension version
         .family = NFPROTO_IPV4,                                     ///< family (here: ipv4)
         .size = XT_ALIGN(sizeof(struct seng_mt_info)),              ///< rule size in kernel module
-        .userspacesize = XT_ALIGN(sizeof(struct seng_mt_info)),     ///< rule size in user space (e.g. this library)
+        .userspacesize = offsetof(struct seng_mt_info, prog), ///< rule size in user space (e.g. this library), excludes kernel-internal fields
         .help = seng_mt_help,                                       ///< function which prints out usage info
         .init = seng_mt_init,                                       ///< function which initializes the match
         .parse = seng_mt4_parse,                                    ///< function which parses command-line input
@@ -401,11 +480,27 @@ static struct xtables_match seng_mt_reg = {
         .print = seng_mt4_print,                                    ///< function which prints out the match
         .save = seng_mt4_save,                                      ///< function that saves the match in parsable form to stdout
         .extra_opts = seng_mt_opts,                                 ///< pointer to list of additional command-line options
+    },
+    {
+        .version = XTABLES_VERSION,                                 ///< x_tables version
+        .name = "seng",                                             ///< extension name
+        .revision = 0,                                              ///< extension version
+        .family = NFPROTO_IPV6,                                     ///< family (here: ipv6)
+        .size = XT_ALIGN(sizeof(struct seng_mt_info)),              ///< rule size in kernel module
+        .userspacesize = offsetof(struct seng_mt_info, prog), ///< rule size in user space (e.g. this library), excludes kernel-internal fields
+        .help = seng_mt_help,                                       ///< function which prints out usage info
+        .init = seng_mt_init,                                       ///< function which initializes the match
+        .parse = seng_mt6_parse,                                    ///< function which parses command-line input
+        .final_check = seng_mt_check,                               ///< function which does the final check
+        .print = seng_mt6_print,                                    ///< function which prints out the match
+        .save = seng_mt6_save,                                      ///< function that saves the match in parsable form to stdout
+        .extra_opts = seng_mt_opts,                                 ///< pointer to list of additional command-line options
+    },
 };
 
 /**
- * @brief registers matching library against ip_tables/x_tables
+ * @brief registers matching library against ip_tables/ip6tables/x_tables
  * */
 void _init(void) {
-	xtables_register_match(&seng_mt_reg);
+	xtables_register_matches(seng_mt_reg, sizeof(seng_mt_reg) / sizeof(seng_mt_reg[0]));
 }
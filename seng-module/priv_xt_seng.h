@@ -0,0 +1,33 @@
+#ifndef SENG_PRIV_XT_SENG_H
+#define SENG_PRIV_XT_SENG_H
+
+#include <linux/skbuff.h>
+
+#include "xt_seng_metadb.h"
+
+/**
+ * @brief the side of the packet a predicate or lookup refers to
+ * */
+enum seng_op_dir {
+    SENG_DIR_SRC,       ///< source enclave
+    SENG_DIR_DST,       ///< destination enclave
+};
+
+/**
+ * @brief resolves one side of a packet
+ *
+ * Shares the per-packet lookup cache (and the ct_cache mode) of the seng match with the other
+ * packet path frontends, i.e., the SENGMAP and SENGMARK targets.
+ * Must be called with bottom halves disabled and inside an RCU read-side critical section.
+ * The returned enclave (and its app) stays valid until the end of the critical section.
+ *
+ * @param[in] skb       the packet
+ * @param[in] db        the active database of the namespace of the packet
+ * @param[in] family    NFPROTO_IPV4 or NFPROTO_IPV6
+ * @param[in] dir       the side of the packet
+ *
+ * @return the enclave, or NULL if the address is no known enclave
+ * */
+const struct enclave *seng_lookup(const struct sk_buff *skb, struct seng_metadb *db, uint8_t family, uint8_t dir);
+
+#endif
@@ -9,11 +9,18 @@
  *
  * Will be executed, when the kernel module receives a generic netlink message.
  * Handles one of those scenarios, depending on the flags that are set:
- * * adds/removes enclaves
+ * * adds/removes ipv4 or ipv6 enclaves (optionally deleting the conntrack entries of removed enclaves)
+ * * adds a batch of enclaves
+ * * enables/disables subnet mode
  * * flushes all entries
+ * * begins, commits or aborts a staged database (the other operations target it if XT_SENG_ATTR_STAGED is set)
+ * * adds/removes/flushes entries of the policy map (XT_SENG_ATTR_POLICY)
  * * sets the database_ready variable to ready
  * * sets the database_ready variable to not ready
  *
+ * Operates on the database of the network namespace of the sender.
+ * Successful changes of the active database are multicast as GENL_XT_SENG_EVENT messages.
+ *
  * @param[in] skb   socket buffer
  * @param[in] info  message info
  *
@@ -21,6 +28,21 @@
  * */
 int seng_nl_recv_msg(struct sk_buff *skb, struct genl_info* info);
 
+/**
+ * @brief genl kernel module dump callback function
+ *
+ * Streams all enclaves of the active database of the sender's network namespace with their app hash, host ip and categories,
+ * one message per enclave. Called repeatedly by netlink until the whole database has been dumped.
+ * The slot number of the next enclave is kept as resumable cursor in the netlink callback.
+ * Parts following a database change are flagged with NLM_F_DUMP_INTR.
+ *
+ * @param[in] skb   socket buffer of the dump message
+ * @param[in] cb    netlink dump callback, keeps the cursor
+ *
+ * @return length of the dump message, 0 once the dump is complete
+ * */
+int seng_nl_dump_enclaves(struct sk_buff *skb, struct netlink_callback* cb);
+
 extern struct genl_family genl_seng_family;
 
 /**
@@ -9,27 +9,384 @@
 #include <linux/netlink.h>
 #include <net/genetlink.h>
 
+#include <net/netfilter/nf_conntrack.h>
+#include <net/netfilter/nf_conntrack_labels.h>
+#include <net/netfilter/nf_conntrack_ecache.h>
+
 #include <linux/ip.h> //iphdr
+#include <linux/ipv6.h> //ipv6hdr
+#include <net/ipv6.h> //ipv6_addr_equal
+#include <linux/percpu.h>
+#include <linux/log2.h> //is_power_of_2
 #include <linux/slab.h> //kmalloc
 #include <linux/string.h> //strcmp, strcpy
 
 #include "xt_seng.h"
+#include "priv_xt_seng.h"
 #include "priv_xt_seng_genl.h"
 #include "xt_seng_metadb.h"
+#include "xt_seng_stats.h"
+
+#define CREATE_TRACE_POINTS
+#include "xt_seng_trace.h"
 
-MODULE_LICENSE("AGPL");
+MODULE_LICENSE("GPL");
 MODULE_AUTHOR("Leon Trampert <leon.trampert@cispa.saarland>"); // student assistant
 MODULE_AUTHOR("Fabian Schwarz <fabian.schwarz@cispa.saarland>"); // lead author
 MODULE_AUTHOR("Christian Rossow <christian.rossow@cispa.saarland>"); // supervisor
 MODULE_DESCRIPTION("SENG extension for iptables");
 
+static bool ct_cache;
+module_param(ct_cache, bool, 0444);
+MODULE_PARM_DESC(ct_cache, "cache the resolved enclaves in the conntrack labels of a flow (see ct_cache_label, default: off)");
+
+///amount of conntrack label bits used by the ct_cache mode (one 32 bit slot number per side)
+#define SENG_CT_LABEL_BITS 64
+
+static unsigned int ct_cache_label = 64;
+module_param(ct_cache_label, uint, 0444);
+MODULE_PARM_DESC(ct_cache_label, "first of the 64 conntrack label bits used by ct_cache (multiple of 32, at most 64, default: 64)");
+
+/**
+ * @brief predicate types of a compiled rule
+ *
+ * Same order as the predicate counters of @link seng_stat @endlink.
+ * */
+enum seng_op_type {
+    SENG_OP_HOST,       ///< host ip (subnet) predicate
+    SENG_OP_CAT,        ///< category predicate
+    SENG_OP_APP,        ///< app hash predicate
+};
+
+///maximum amount of predicates of a rule (app, category and host per side)
+#define SENG_MT_MAX_OPS 6
+
+/**
+ * @brief a single precompiled predicate
+ * */
+struct seng_mt_op {
+    uint8_t type;                       ///< predicate type (see enum seng_op_type)
+    uint8_t dir;                        ///< side of the packet (see enum seng_op_dir)
+    bool inv;                           ///< predicate is inverted
+    uint16_t cat_id;                    ///< SENG_OP_CAT: interned category id
+    uint32_t host;                      ///< SENG_OP_HOST: pre-masked host ip
+    uint32_t mask;                      ///< SENG_OP_HOST: host subnet mask
+    uint8_t app_hash[SGX_HASH_SIZE];    ///< SENG_OP_APP: app hash
+    struct in6_addr host6;              ///< SENG_OP_HOST of ipv6 rules: pre-masked host ip
+    struct in6_addr mask6;              ///< SENG_OP_HOST of ipv6 rules: host subnet mask
+};
+
+/**
+ * @brief the precompiled program of a rule
+ *
+ * Built by seng_mt_check() from the rule info. Contains only the predicates used by the rule,
+ * grouped by side (source first) and ordered from cheap to expensive within a side,
+ * so seng_mt() evaluates them in a tight loop and looks up each side at most once.
+ * */
+struct seng_mt_prog {
+    uint8_t n_ops;                                  ///< amount of predicates
+    struct seng_mt_op ops[SENG_MT_MAX_OPS];         ///< the predicates
+} ____cacheline_aligned;
+
+/**
+ * @brief per-packet enclave lookup cache
+ *
+ * One entry per cpu, which stores the enclaves resolved for the packet currently traversing the table,
+ * so that consecutive seng rules on the same packet skip the lookups.
+ * The entry is only valid for the same skb and addresses and as long as the database did not change.
+ * Keyed on the database generation, so packets of different network namespaces never share results.
+ * */
+struct seng_lookup_cache {
+    const struct sk_buff *skb;          ///< the packet
+    uint32_t addr[2];                   ///< source and destination ip of the packet (ipv4 only)
+    u64 gen;                            ///< database generation of the lookups
+    unsigned int seq;                   ///< database sequence counter at the time of the lookups
+    uint8_t resolved;                   ///< bitmask of the sides which have been looked up
+    const struct enclave *enc[2];       ///< source and destination enclave (or NULL)
+};
+
+/**
+ * @brief per-packet enclave lookup cache of ipv6 packets
+ *
+ * Kept apart from the ipv4 cache, so that the ipv4 path keeps comparing 32 bit addresses only.
+ * */
+struct seng_lookup_cache6 {
+    struct seng_lookup_cache c;         ///< the cache entry (without its ipv4 addresses)
+    struct in6_addr addr[2];            ///< source and destination ip of the packet
+};
+
+static DEFINE_PER_CPU(struct seng_lookup_cache, seng_cache);
+static DEFINE_PER_CPU(struct seng_lookup_cache6, seng_cache6);
+
+/**
+ * @brief prepares the lookup cache of this cpu for the given packet
+ *
+ * Resets the cache if it belongs to another packet or to an outdated database.
+ * Must be called with bottom halves disabled and inside an RCU read-side critical section.
+ *
+ * @param[in] skb       the packet
+ * @param[in] iph       ip header of the packet
+ * @param[in] db        the active database of the namespace of the packet
+ *
+ * @return the lookup cache of this cpu
+ * */
+static inline struct seng_lookup_cache *seng_cache_get(const struct sk_buff *skb, const struct iphdr *iph, const struct seng_metadb *db) {
+    struct seng_lookup_cache *c = this_cpu_ptr(&seng_cache);
+    unsigned int seq = metadb_read_seq(db);
+
+    if (c->skb != skb || c->gen != db->gen || c->seq != seq || c->addr[SENG_DIR_SRC] != iph->saddr || c->addr[SENG_DIR_DST] != iph->daddr) {
+        c->skb = skb;
+        c->gen = db->gen;
+        c->seq = seq;
+        c->addr[SENG_DIR_SRC] = iph->saddr;
+        c->addr[SENG_DIR_DST] = iph->daddr;
+        c->resolved = 0;
+    }
+
+    return c;
+}
+
+/**
+ * @brief prepares the ipv6 lookup cache of this cpu for the given packet
+ *
+ * Same as seng_cache_get(), but for ipv6 packets.
+ *
+ * @param[in] skb       the packet
+ * @param[in] ip6h      ipv6 header of the packet
+ * @param[in] db        the active database of the namespace of the packet
+ *
+ * @return the lookup cache of this cpu
+ * */
+static inline struct seng_lookup_cache *seng_cache6_get(const struct sk_buff *skb, const struct ipv6hdr *ip6h, const struct seng_metadb *db) {
+    struct seng_lookup_cache6 *c6 = this_cpu_ptr(&seng_cache6);
+    struct seng_lookup_cache *c = &c6->c;
+    unsigned int seq = metadb_read_seq(db);
+
+    if (c->skb != skb || c->gen != db->gen || c->seq != seq ||
+        !ipv6_addr_equal(&c6->addr[SENG_DIR_SRC], &ip6h->saddr) || !ipv6_addr_equal(&c6->addr[SENG_DIR_DST], &ip6h->daddr)) {
+        c->skb = skb;
+        c->gen = db->gen;
+        c->seq = seq;
+        c6->addr[SENG_DIR_SRC] = ip6h->saddr;
+        c6->addr[SENG_DIR_DST] = ip6h->daddr;
+        c->resolved = 0;
+    }
+
+    return c;
+}
+
+/**
+ * @brief looks up an address of the given family in the database
+ *
+ * @param[in] db        the active database
+ * @param[in] addr      the address (uint32_t or struct in6_addr)
+ * @param[in] family    NFPROTO_IPV4 or NFPROTO_IPV6
+ *
+ * @return the enclave, or NULL if the address is no known enclave
+ * */
+static __always_inline const struct enclave *seng_find(struct seng_metadb *db, const void *addr, uint8_t family) {
+    if (family == NFPROTO_IPV6) return find_enclave6(db, addr);
+    return find_enclave(db, *(const uint32_t *) addr);
+}
+
+/**
+ * @brief checks if an enclave has the given address
+ *
+ * @param[in] e         the enclave
+ * @param[in] addr      the address (uint32_t or struct in6_addr)
+ * @param[in] family    NFPROTO_IPV4 or NFPROTO_IPV6
+ *
+ * @return true if the enclave has the address, else false
+ * */
+static __always_inline bool seng_enclave_has_addr(const struct enclave *e, const void *addr, uint8_t family) {
+    if (family == NFPROTO_IPV6) return e->family == AF_INET6 && ipv6_addr_equal(&e->enclave_ip6, addr);
+    return e->family == AF_INET && e->enclave_ip == *(const uint32_t *) addr;
+}
+
+/**
+ * @brief resolves one side of a packet via the conntrack entry of its flow (ct_cache mode)
+ *
+ * The conntrack labels of a flow store a reference (slot number, see find_enclave_by_slot()) to the enclave
+ * of each side of the original direction in the label bits starting at ct_cache_label. The first packet of a flow
+ * resolves the enclaves via the database and stores the references, later packets of the flow skip the database lookup.
+ * Only the words of the reference are replaced, the other label bits are left to other users (e.g., -m connlabel).
+ * The enclave ip is compared against the packet, which invalidates references to removed enclaves (even if their
+ * slot has been reused) and also covers NAT'ed packets.
+ *
+ * @param[in] db        the active database
+ * @param[in] skb       the packet
+ * @param[in] addr      the ip of the side (uint32_t or struct in6_addr)
+ * @param[in] family    NFPROTO_IPV4 or NFPROTO_IPV6
+ * @param[in] dir       the side of the packet
+ *
+ * @return the enclave, or NULL if the address is no known enclave
+ * */
+static __always_inline const struct enclave *seng_ct_lookup(struct seng_metadb *db, const struct sk_buff *skb, const void *addr, uint8_t family, uint8_t dir) {
+    enum ip_conntrack_info ctinfo;
+    struct nf_conn *ct = nf_ct_get(skb, &ctinfo);
+    struct nf_conn_labels *labels;
+    const struct enclave *e;
+    uint32_t data[NF_CT_LABELS_MAX_SIZE / sizeof(uint32_t)] = { 0 };
+    uint32_t mask[NF_CT_LABELS_MAX_SIZE / sizeof(uint32_t)] = { 0 };
+    uint32_t *words;
+    unsigned int w;
+
+    if (!ct || nf_ct_is_template(ct) || !(labels = nf_ct_labels_find(ct))) {
+        seng_stat_inc(SENG_STAT_LOOKUPS);
+        return seng_find(db, addr, family);
+    }
+
+    // first word: source of the original direction, second word: destination of the original direction
+    w = ct_cache_label / 32 + (dir ^ (CTINFO2DIR(ctinfo) == IP_CT_DIR_REPLY));
+    words = (uint32_t *) labels->bits;
+
+    e = find_enclave_by_slot(db, READ_ONCE(words[w]));
+    if (e && seng_enclave_has_addr(e, addr, family)) {
+        seng_stat_inc(SENG_STAT_CT_HITS);
+        return e;
+    }
+
+    seng_stat_inc(SENG_STAT_LOOKUPS);
+    e = seng_find(db, addr, family);
+    if (e) {
+        // covers all words, as the words behind the given ones would be cleared
+        data[w] = e->ct_slot;
+        mask[w] = ~0U;
+        nf_connlabels_replace(ct, data, mask, ARRAY_SIZE(data));
+    }
+
+    return e;
+}
+
+/**
+ * @brief resolves one side of the cached packet
+ *
+ * @param[in,out] c     the lookup cache (embedded in a seng_lookup_cache6 for ipv6)
+ * @param[in] db        the active database
+ * @param[in] family    NFPROTO_IPV4 or NFPROTO_IPV6
+ * @param[in] dir       the side of the packet
+ *
+ * @return the enclave, or NULL if the address is no known enclave
+ * */
+static __always_inline const struct enclave *seng_cache_lookup(struct seng_lookup_cache *c, struct seng_metadb *db, uint8_t family, uint8_t dir) {
+    const void *addr;
+
+    if (!(c->resolved & (1 << dir))) {
+        if (family == NFPROTO_IPV6) addr = &container_of(c, struct seng_lookup_cache6, c)->addr[dir];
+        else addr = &c->addr[dir];
+
+        if (ct_cache) {
+            c->enc[dir] = seng_ct_lookup(db, c->skb, addr, family, dir);
+        } else {
+            seng_stat_inc(SENG_STAT_LOOKUPS);
+            c->enc[dir] = seng_find(db, addr, family);
+        }
+        if (!c->enc[dir]) seng_stat_inc(SENG_STAT_LOOKUP_MISSES);
+        trace_seng_lookup(family, addr, dir, c->enc[dir] != NULL);
+        c->resolved |= 1 << dir;
+    } else {
+        seng_stat_inc(SENG_STAT_CACHE_HITS);
+    }
+
+    return c->enc[dir];
+}
+
+const struct enclave *seng_lookup(const struct sk_buff *skb, struct seng_metadb *db, uint8_t family, uint8_t dir) {
+    struct seng_lookup_cache *cache;
+
+    if (family == NFPROTO_IPV6) {
+        cache = seng_cache6_get(skb, ipv6_hdr(skb), db);
+        return seng_cache_lookup(cache, db, NFPROTO_IPV6, dir);
+    }
+
+    cache = seng_cache_get(skb, ip_hdr(skb), db);
+    return seng_cache_lookup(cache, db, NFPROTO_IPV4, dir);
+}
+
+/**
+ * @brief evaluates a single predicate against an enclave
+ *
+ * @param[in] op        the predicate
+ * @param[in] e         the enclave of the side the predicate refers to
+ *
+ * @return true if the predicate holds (incl. inversion), false otherwise
+ * */
+static inline bool seng_mt_eval(const struct seng_mt_op *op, const struct enclave *e) {
+    bool match;
+
+    switch (op->type) {
+        case SENG_OP_HOST:
+            // rules of a family only ever see enclaves of that family
+            if (e->family == AF_INET6) match = !ipv6_masked_addr_cmp(&e->host_ip6, &op->mask6, &op->host6);
+            else match = (e->host_ip & op->mask) == op->host;
+            break;
+        case SENG_OP_CAT:
+            match = match_category(e->a, op->cat_id);
+            break;
+        default:
+            match = match_app(e->a, op->app_hash);
+            break;
+    }
+
+    return match != op->inv;
+}
+
+/**
+ * @brief runs a rule program against the cached packet
+ *
+ * Inlined per family, so that the family checks of the lookups are resolved at compile time.
+ * Must be called with bottom halves disabled and inside an RCU read-side critical section.
+ *
+ * @param[in] prog      the rule program
+ * @param[in,out] cache the lookup cache of the packet
+ * @param[in] db        the active database
+ * @param[in] family    NFPROTO_IPV4 or NFPROTO_IPV6
+ *
+ * @return true upon match, false otherwise
+ * */
+static __always_inline bool seng_mt_run(const struct seng_mt_prog *prog, struct seng_lookup_cache *cache, struct seng_metadb *db, uint8_t family) {
+    const struct seng_mt_op *op;
+    const struct enclave *e = NULL;
+    int dir = -1;
+
+    for (op = prog->ops; op < prog->ops + prog->n_ops; op++) {
+        //find enclave upon first predicate of the side
+        if (op->dir != dir) {
+            dir = op->dir;
+            e = seng_cache_lookup(cache, db, family, dir);
+        }
+
+        if (e) seng_stat_inc(SENG_STAT_PRED_HOST + op->type);
+
+        if (!e || !seng_mt_eval(op, e)) {
+            seng_stat_inc(SENG_STAT_PRED_FAILS);
+            trace_seng_match(prog, family, false);
+            return false;
+        }
+    }
+
+    seng_stat_inc(SENG_STAT_MATCHED);
+    trace_seng_match(prog, family, true);
+    return true;
+}
+
 /**
  * @brief decides if a packet matches a rule (match) or not
  *
  * Will be called with packet and rule info to decide, if the packet matches the rule or not. Does a lookup
- * of the destination and source ip of the arriving packet in the hash table. If the database is currently not ready,
+ * of the destination and/or source ip of the arriving packet in the hash table. If the database is currently not ready,
  * the incoming packets will be dropped by this function.
  *
+ * The predicates of the precompiled rule program are evaluated in order, the first failing one ends the match.
+ * A side of the packet is only looked up once its first predicate is reached, i.e., sides which are not
+ * referenced by the rule or which follow a failed predicate are never looked up.
+ * A predicate never holds if its side of the packet is not a known enclave.
+ * The lookup results are shared with the following seng rules on the same packet (see seng_lookup_cache).
+ *
+ * The lookups and the matching form a pure RCU read-side critical section, i.e., the packet path never
+ * takes the database lock and scales with the number of cores.
+ * Packets are matched against the database of the network namespace of the rule.
+ *
  * By setting hotdrop in the xt_action_param to true, the packet will be dropped.
  *
  * @param[in] skb       socket buffer containing the arriving packet
@@ -39,105 +396,156 @@ MODULE_DESCRIPTION("SENG extension for iptables");
  * */
 bool seng_mt (const struct sk_buff *skb, struct xt_action_param* xap) {
     const struct iphdr *iph;
-    const struct seng_mt_info *info;
-    struct enclave *src_enc, *dst_enc;
-    struct app *src_app, *dst_app;
-    uint8_t searched = 0;
-    uint8_t found = 0;
-    uint8_t match = 0;
-    uint32_t inv_flag = 0;
-
-    //get rule info
-     info = xap->matchinfo;
-
-    //setting hotdrop to true will drop the packet
+    const struct seng_mt_prog *prog;
+    struct seng_lookup_cache *cache;
+    struct seng_metadb *db;
+    bool match;
+
+    //get rule program
+    prog = ((const struct seng_mt_info *) xap->matchinfo)->prog;
+
+    seng_stat_inc(SENG_STAT_MATCH_CALLS);
+
+    //setting hotdrop to true will drop the packet (counted, but not logged from the packet path)
     if(!skb) {
-        printk(KERN_ERR "xt_seng: No skb!");
+        seng_stat_inc(SENG_STAT_HOTDROPS);
         xap->hotdrop = true;
         return false;
     }
 
     //get packet
-     iph = ip_hdr(skb);
-
-    //find enclaves
-    src_enc = find_enclave(iph->saddr);
-    dst_enc = find_enclave(iph->daddr);
-
-    src_app = NULL;
-    dst_app = NULL;
-
-    if (src_enc)
-        src_app = src_enc->a;
-    if (dst_enc)
-        dst_app = dst_enc->a;
-
-    /* Search the enclave entry for the stuff specified in the rule. */
-    if (info->flags & XT_SENG_APP_SRC) {
-        searched += 1;
-        if (src_app) {
-            match = match_app(src_app, info->app_hash_src);
-            inv_flag = !!(XT_SENG_APP_SRC_INV & info->flags);
-            if ((match && !inv_flag) || (!match && inv_flag)) found += 1;
-        }
-    }
+    iph = ip_hdr(skb);
 
-    if (info->flags & XT_SENG_APP_DST) {
-        searched += 1;
-        if (dst_app) {
-            match = match_app(dst_app, info->app_hash_dst);
-            inv_flag = !!(XT_SENG_APP_DST_INV & info->flags);
-            if ((match && !inv_flag) || (!match && inv_flag)) found += 1;
-        }
-    }
+    // the per-cpu cache must not be interrupted by packets of the softirq
+    local_bh_disable();
+    rcu_read_lock();
 
-    if (info->flags & XT_SENG_CAT_SRC) {
-        searched += 1;
-        if (src_app) {
-            match = match_category(src_app, info->category_name_src);
-            inv_flag = !!(XT_SENG_CAT_SRC_INV & info->flags);
-            if ((match && !inv_flag) || (!match && inv_flag)) found += 1;
-        }
-    }
+    db = rcu_dereference(seng_pernet(xt_net(xap))->metadb);
+    cache = seng_cache_get(skb, iph, db);
+    match = seng_mt_run(prog, cache, db, NFPROTO_IPV4);
 
-    if (info->flags & XT_SENG_CAT_DST) {
-        searched += 1;
-        if (dst_app) {
-            match = match_category(dst_app, info->category_name_dst);
-            inv_flag = !!(XT_SENG_CAT_DST_INV & info->flags);
-            if ((match && !inv_flag) || (!match && inv_flag)) found += 1;
-        }
-    }
+    rcu_read_unlock();
+    local_bh_enable();
 
-    if (info->flags & XT_SENG_HOST_SRC) {
-        searched += 1;
-        if (src_enc) {
-            match = (info->host_src.ip & info->src_subnet.ip) == (src_enc->host_ip & info->src_subnet.ip);
-            inv_flag = !!(XT_SENG_HOST_SRC_INV & info->flags);
-            if ((match && !inv_flag) || (!match && inv_flag)) {
-                found += 1;
-            }
-        }
+    return match;
+}
+
+/**
+ * @brief decides if an ipv6 packet matches a rule (match) or not
+ *
+ * Same as seng_mt(), but for ipv6 packets, which are looked up among the ipv6 enclaves.
+ *
+ * @param[in] skb       socket buffer containing the arriving packet
+ * @param[in,out] xap   contains the rule info and provides the hotdrop functionality
+ *
+ * @return true upon match, false otherwise
+ * */
+bool seng_mt6 (const struct sk_buff *skb, struct xt_action_param* xap) {
+    const struct ipv6hdr *ip6h;
+    const struct seng_mt_prog *prog;
+    struct seng_lookup_cache *cache;
+    struct seng_metadb *db;
+    bool match;
+
+    prog = ((const struct seng_mt_info *) xap->matchinfo)->prog;
+
+    seng_stat_inc(SENG_STAT_MATCH_CALLS);
+
+    if(!skb) {
+        seng_stat_inc(SENG_STAT_HOTDROPS);
+        xap->hotdrop = true;
+        return false;
     }
 
-    if (info->flags & XT_SENG_HOST_DST) {
-        searched += 1;
-        if (dst_enc) {
-            match = (info->host_dst.ip & info->dst_subnet.ip) == (dst_enc->host_ip & info->dst_subnet.ip);
-            inv_flag = !!(XT_SENG_HOST_DST_INV & info->flags);
-            if ((match && !inv_flag) || (!match && inv_flag)) {
-                found += 1;
-            }
-        }
+    ip6h = ipv6_hdr(skb);
+
+    local_bh_disable();
+    rcu_read_lock();
+
+    db = rcu_dereference(seng_pernet(xt_net(xap))->metadb);
+    cache = seng_cache6_get(skb, ip6h, db);
+    match = seng_mt_run(prog, cache, db, NFPROTO_IPV6);
+
+    rcu_read_unlock();
+    local_bh_enable();
+
+    return match;
+}
+
+/**
+ * @brief releases a rule program
+ *
+ * Releases the interned categories of the program and frees it.
+ *
+ * @param[in] prog  the rule program
+ * @param[in] cats  the category table of the namespace of the rule
+ * */
+static void seng_mt_free_prog(struct seng_mt_prog *prog, struct seng_cats *cats) {
+    int i;
+
+    for (i = 0; i < prog->n_ops; i++) {
+        if (prog->ops[i].type == SENG_OP_CAT) put_cat(cats, prog->ops[i].cat_id);
     }
 
-    //positive check: all found and positive rule -> packet matches
-    if (searched == found) {
-        return true;
+    kfree(prog);
+}
+
+/**
+ * @brief appends a predicate to a rule program
+ *
+ * @param[in,out] prog  the rule program
+ * @param[in] cats      the category table of the namespace of the rule
+ * @param[in] info      the rule info
+ * @param[in] family    the family of the rule (NFPROTO_IPV4 or NFPROTO_IPV6)
+ * @param[in] type      the predicate type
+ * @param[in] dir       the side of the packet
+ *
+ * @return 0 on success, else a negative error code
+ * */
+static int seng_mt_compile_op(struct seng_mt_prog *prog, struct seng_cats *cats, struct seng_mt_info *info, uint8_t family, uint8_t type, uint8_t dir) {
+    static const uint16_t flag[3][2] = {
+        [SENG_OP_HOST] = { XT_SENG_HOST_SRC, XT_SENG_HOST_DST },
+        [SENG_OP_CAT]  = { XT_SENG_CAT_SRC, XT_SENG_CAT_DST },
+        [SENG_OP_APP]  = { XT_SENG_APP_SRC, XT_SENG_APP_DST },
+    };
+    const union nf_inet_addr *host, *mask;
+    struct seng_mt_op *op;
+    char *cat_name;
+    int cat_id, i;
+
+    if (!(info->flags & flag[type][dir])) return 0;
+
+    op = &prog->ops[prog->n_ops];
+    op->type = type;
+    op->dir = dir;
+    // the inverter flag always follows the flag of the predicate
+    op->inv = !!(info->flags & (flag[type][dir] << 1));
+
+    switch (type) {
+        case SENG_OP_HOST:
+            host = dir == SENG_DIR_SRC ? &info->host_src : &info->host_dst;
+            mask = dir == SENG_DIR_SRC ? &info->src_subnet : &info->dst_subnet;
+            if (family == NFPROTO_IPV6) {
+                op->mask6 = mask->in6;
+                for (i = 0; i < 4; i++) op->host6.s6_addr32[i] = host->ip6[i] & mask->ip6[i];
+            } else {
+                op->mask = mask->ip;
+                op->host = host->ip & op->mask;
+            }
+            break;
+        case SENG_OP_CAT:
+            cat_name = dir == SENG_DIR_SRC ? info->category_name_src : info->category_name_dst;
+            cat_name[MAX_CAT_NAME_LENGTH - 1] = 0;
+            if ((cat_id = intern_cat(cats, cat_name)) < 0) return cat_id;
+            op->cat_id = cat_id;
+            break;
+        default:
+            memcpy(op->app_hash, dir == SENG_DIR_SRC ? info->app_hash_src : info->app_hash_dst, SGX_HASH_SIZE);
+            break;
     }
 
-    //packet does not match rule
-    return false;
+    prog->n_ops++;
+    return 0;
 }
 
 /**
@@ -145,65 +553,389 @@ bool seng_mt (const struct sk_buff *skb, struct xt_action_param* xap) {
  *
  * Will be called to check a newly added rule for correctness.
  * Rejects if not a single flag is set in the rule info.
+ * Compiles the rule info into a rule program which only contains the predicates used by the rule.
+ * Category names are resolved to their interned ids, so that the packet path only does a bit test.
  *
  * @param[in] xmp   contains the rule info
  *
  * @return 0 accepts the rule, any other value rejects the rule
  * */
 int seng_mt_check(const struct xt_mtchk_param * xmp) {
-    const struct seng_mt_info *info = xmp->matchinfo;
+    struct seng_mt_info *info = xmp->matchinfo;
+    struct seng_cats *cats = &seng_pernet(xmp->net)->cats;
+    struct seng_mt_prog *prog;
+    uint8_t type, dir;
+    int err = 0;
 
-    printk(KERN_DEBUG "xt_seng: Added a rule with -m seng in the %s table\n", xmp->table);
+    pr_debug("xt_seng: Added a rule with -m seng in the %s table\n", xmp->table);
 
     //check for useless input -> no relevant flag set
     if (!(info->flags & (XT_SENG_APP_DST | XT_SENG_CAT_DST | XT_SENG_HOST_DST | XT_SENG_APP_SRC | XT_SENG_CAT_SRC | XT_SENG_HOST_SRC))) {
-        printk(KERN_INFO "xt_seng: Useless, thus not added");
+        pr_info_ratelimited("xt_seng: Useless, thus not added\n");
         return -EINVAL;
     }
 
-    return 0;
+    // makes sure that new conntrack entries have labels
+    if (ct_cache && (err = nf_connlabels_get(xmp->net, ct_cache_label + SENG_CT_LABEL_BITS - 1)) < 0) {
+        pr_err_ratelimited("xt_seng: Failed to enable conntrack labels (%d)!\n", err);
+        return err;
+    }
+
+    prog = kzalloc(sizeof(*prog), GFP_KERNEL);
+    if (!prog) {
+        if (ct_cache) nf_connlabels_put(xmp->net);
+        return -ENOMEM;
+    }
+
+    // grouped by side, cheap predicates first
+    for (dir = SENG_DIR_SRC; dir <= SENG_DIR_DST && !err; dir++) {
+        for (type = SENG_OP_HOST; type <= SENG_OP_APP && !err; type++) {
+            err = seng_mt_compile_op(prog, cats, info, xmp->family, type, dir);
+        }
+    }
+
+    if (err) {
+        seng_mt_free_prog(prog, cats);
+    } else {
+        info->prog = prog;
+    }
+
+    if (err && ct_cache) nf_connlabels_put(xmp->net);
+
+    return err;
 }
 
 /**
  * @brief called upon rule removal
  *
  * Will be called, once a rule with match in this module was removed in ip_tables.
- * Does nothing but a debug print.
+ * Releases the rule program.
  *
  * @param[in] xmp   contains the rule info
  * */
 void seng_mt_destroy(const struct xt_mtdtor_param * xmp) {
-    printk(KERN_DEBUG "xt_seng: Some rule with seng match was removed.");
+    const struct seng_mt_info *info = xmp->matchinfo;
+
+    seng_mt_free_prog(info->prog, &seng_pernet(xmp->net)->cats);
+
+    if (ct_cache) nf_connlabels_put(xmp->net);
+
+    pr_debug("xt_seng: Some rule with seng match was removed.\n");
 }
 
 /**
- * @brief struct used to register against ip_tables
+ * @brief structs used to register against ip_tables and ip6tables
  *
- * This struct is used to register the kernel module against ip_tables.
+ * These structs are used to register the kernel module against ip_tables and ip6tables.
  * */
-struct xt_match seng_mt4_reg = {
+struct xt_match seng_mt_reg[] = {
+    {
         .name 			= "seng",                                ///< extension name
         .revision 	    = 0,                                     ///< extension version
-        .family 		= AF_INET,                               ///< family (here: ipv4)
+        .family 		= NFPROTO_IPV4,                          ///< family (here: ipv4)
         .match 			= seng_mt,                               ///< match function, called to see if packet matches rule
         .checkentry     = seng_mt_check,                         ///< check function, called upon addition of seng rules
         .destroy 		= seng_mt_destroy,                       ///< destroy function, called upon removal of seng rules
         .me 			= THIS_MODULE,                           ///< module identifier
         .matchsize	    = XT_ALIGN(sizeof(struct seng_mt_info)), ///< rule size
+        .usersize       = offsetof(struct seng_mt_info, prog),   ///< part copied to user space - hides the kernel pointer
+    },
+    {
+        .name 			= "seng",                                ///< extension name
+        .revision 	    = 0,                                     ///< extension version
+        .family 		= NFPROTO_IPV6,                          ///< family (here: ipv6)
+        .match 			= seng_mt6,                              ///< match function, called to see if packet matches rule
+        .checkentry     = seng_mt_check,                         ///< check function, called upon addition of seng rules
+        .destroy 		= seng_mt_destroy,                       ///< destroy function, called upon removal of seng rules
+        .me 			= THIS_MODULE,                           ///< module identifier
+        .matchsize	    = XT_ALIGN(sizeof(struct seng_mt_info)), ///< rule size
+        .usersize       = offsetof(struct seng_mt_info, prog),   ///< part copied to user space - hides the kernel pointer
+    },
+};
+
+/**
+ * @brief looks up the policy of the enclave of a packet
+ *
+ * Must be called with bottom halves disabled and inside an RCU read-side critical section.
+ *
+ * @param[in] skb       the packet
+ * @param[in] par       contains the network namespace and the family of the rule
+ * @param[in] dir       the side of the packet
+ *
+ * @return the policy map entry, or NULL if the side is no known enclave or its app has no policy
+ * */
+static const struct seng_policy_entry *seng_tg_policy (const struct sk_buff *skb, const struct xt_action_param *par, uint8_t dir) {
+    struct seng_net *sn = seng_pernet(xt_net(par));
+    const struct enclave *e;
+
+    e = seng_lookup(skb, rcu_dereference(sn->metadb), xt_family(par), dir);
+    return e ? seng_policy_lookup(&sn->policy, e->a) : NULL;
+}
+
+/**
+ * @brief applies the policy map to a packet
+ *
+ * Resolves the source (or destination) enclave of the packet and looks up the policy of its app in the
+ * policy map of the namespace, i.e., a single rule and a single hash lookup dispatch the policy of all apps.
+ * Sets the packet mark if the entry has one. Packets of unknown enclaves or without a policy get the default verdict of the rule.
+ *
+ * @param[in,out] skb   socket buffer containing the arriving packet
+ * @param[in] par       contains the target info
+ *
+ * @return the netfilter verdict, or XT_CONTINUE
+ * */
+unsigned int seng_map_tg (struct sk_buff *skb, const struct xt_action_param *par) {
+    const struct seng_map_tginfo *info = par->targinfo;
+    const struct seng_policy_entry *pe;
+    uint8_t verdict = info->verdict;
+
+    local_bh_disable();
+    rcu_read_lock();
+
+    pe = seng_tg_policy(skb, par, (info->flags & XT_SENG_MAP_DST) ? SENG_DIR_DST : SENG_DIR_SRC);
+    if (pe) {
+        verdict = pe->verdict;
+        if (pe->has_mark) skb->mark = pe->mark;
+    }
+
+    rcu_read_unlock();
+    local_bh_enable();
+
+    switch (verdict) {
+        case SENG_POLICY_ACCEPT:
+            return NF_ACCEPT;
+        case SENG_POLICY_DROP:
+            return NF_DROP;
+        default:
+            return XT_CONTINUE;
+    }
+}
+
+/**
+ * @brief checks a newly added SENGMAP rule
+ *
+ * @param[in] par   contains the target info
+ *
+ * @return 0 accepts the rule, any other value rejects the rule
+ * */
+int seng_map_tg_check (const struct xt_tgchk_param *par) {
+    const struct seng_map_tginfo *info = par->targinfo;
+
+    if (info->flags & ~XT_SENG_MAP_DST || info->verdict >= __SENG_POLICY_MAX) {
+        pr_info_ratelimited("xt_seng: Invalid SENGMAP rule\n");
+        return -EINVAL;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief labels a packet or its flow with the mark of its enclave's policy
+ *
+ * Resolves the enclave of the packet and writes the mark of its policy map entry (see set_app_policy_ack())
+ * into the masked bits of the packet mark or of the conntrack mark, so that later stages (tc, routing policy,
+ * accounting) classify the packet by the mark instead of another database lookup.
+ * A flow of a known enclave is resolved only once: the rule's resolved bit of the conntrack mark flags it,
+ * independently of the value of the mark and of whether the app has a policy at all.
+ * The conntrack entries of removed enclaves are deleted (see XT_SENG_ATTR_CT_FLUSH), which drops their marks.
+ * Never issues a verdict.
+ *
+ * @param[in,out] skb   socket buffer containing the arriving packet
+ * @param[in] par       contains the target info
+ *
+ * @return XT_CONTINUE
+ * */
+unsigned int seng_mark_tg (struct sk_buff *skb, const struct xt_action_param *par) {
+    const struct seng_mark_tginfo *info = par->targinfo;
+    struct seng_net *sn = seng_pernet(xt_net(par));
+    const struct seng_policy_entry *pe = NULL;
+    const struct enclave *e;
+    struct nf_conn *ct = NULL;
+    bool found = false;
+    uint32_t mark = 0;
+
+#ifdef CONFIG_NF_CONNTRACK_MARK
+    if (info->flags & XT_SENG_MARK_CT) {
+        enum ip_conntrack_info ctinfo;
+
+        ct = nf_ct_get(skb, &ctinfo);
+        if (!ct || nf_ct_is_template(ct)) return XT_CONTINUE;
+
+        // the flow has already been resolved
+        if (READ_ONCE(ct->mark) & info->resolved) return XT_CONTINUE;
+    }
+#endif
+
+    local_bh_disable();
+    rcu_read_lock();
+
+    e = seng_lookup(skb, rcu_dereference(sn->metadb), xt_family(par), (info->flags & XT_SENG_MARK_DST) ? SENG_DIR_DST : SENG_DIR_SRC);
+    if (e) pe = seng_policy_lookup(&sn->policy, e->a);
+    if (pe && pe->has_mark) {
+        found = true;
+        mark = pe->mark;
+    }
+
+    rcu_read_unlock();
+    local_bh_enable();
+
+    // flows of unknown addresses are retried, their enclave might be registered later
+    if (!e) return XT_CONTINUE;
+
+#ifdef CONFIG_NF_CONNTRACK_MARK
+    if (ct) {
+        uint32_t oldmark = READ_ONCE(ct->mark);
+        uint32_t newmark = oldmark | info->resolved;
+
+        if (found) newmark = (newmark & ~info->mask) | (mark & info->mask);
+
+        if (oldmark != newmark) {
+            WRITE_ONCE(ct->mark, newmark);
+            nf_conntrack_event_cache(IPCT_MARK, ct);
+        }
+        return XT_CONTINUE;
+    }
+#endif
+
+    if (found) skb->mark = (skb->mark & ~info->mask) | (mark & info->mask);
+    return XT_CONTINUE;
+}
+
+/**
+ * @brief checks a newly added SENGMARK rule
+ *
+ * Enables connection tracking in the namespace of the rule if the rule writes the conntrack mark.
+ * Conntrack mark rules need a single resolved bit outside of the mask.
+ *
+ * @param[in] par   contains the target info
+ *
+ * @return 0 accepts the rule, any other value rejects the rule
+ * */
+int seng_mark_tg_check (const struct xt_tgchk_param *par) {
+    const struct seng_mark_tginfo *info = par->targinfo;
+    bool ct_mark = info->flags & XT_SENG_MARK_CT;
+    int err;
+
+    if (info->flags & ~(XT_SENG_MARK_DST | XT_SENG_MARK_CT) || !info->mask ||
+        (ct_mark && (!is_power_of_2(info->resolved) || (info->resolved & info->mask))) || (!ct_mark && info->resolved)) {
+        pr_info_ratelimited("xt_seng: Invalid SENGMARK rule\n");
+        return -EINVAL;
+    }
+
+    if (!ct_mark) return 0;
+
+#ifdef CONFIG_NF_CONNTRACK_MARK
+    if ((err = nf_ct_netns_get(par->net, par->family)) < 0) {
+        pr_err_ratelimited("xt_seng: Failed to enable connection tracking (%d)!\n", err);
+        return err;
+    }
+    return 0;
+#else
+    err = -EOPNOTSUPP;
+    pr_info_ratelimited("xt_seng: SENGMARK --ctmark requires CONFIG_NF_CONNTRACK_MARK\n");
+    return err;
+#endif
+}
+
+/**
+ * @brief called upon removal of a SENGMARK rule
+ *
+ * @param[in] par   contains the target info
+ * */
+void seng_mark_tg_destroy (const struct xt_tgdtor_param *par) {
+    const struct seng_mark_tginfo *info = par->targinfo;
+
+    if (info->flags & XT_SENG_MARK_CT) nf_ct_netns_put(par->net, par->family);
+}
+
+/**
+ * @brief structs used to register the SENGMAP and SENGMARK targets against ip_tables and ip6tables
+ * */
+struct xt_target seng_tg_reg[] = {
+    {
+        .name           = "SENGMAP",                                ///< extension name
+        .revision       = 0,                                        ///< extension version
+        .family         = NFPROTO_IPV4,                             ///< family (here: ipv4)
+        .target         = seng_map_tg,                              ///< target function, called per packet
+        .checkentry     = seng_map_tg_check,                        ///< check function, called upon addition of SENGMAP rules
+        .me             = THIS_MODULE,                              ///< module identifier
+        .targetsize     = XT_ALIGN(sizeof(struct seng_map_tginfo)), ///< rule size
+    },
+    {
+        .name           = "SENGMAP",                                ///< extension name
+        .revision       = 0,                                        ///< extension version
+        .family         = NFPROTO_IPV6,                             ///< family (here: ipv6)
+        .target         = seng_map_tg,                              ///< target function, called per packet
+        .checkentry     = seng_map_tg_check,                        ///< check function, called upon addition of SENGMAP rules
+        .me             = THIS_MODULE,                              ///< module identifier
+        .targetsize     = XT_ALIGN(sizeof(struct seng_map_tginfo)), ///< rule size
+    },
+    {
+        .name           = "SENGMARK",                               ///< extension name
+        .revision       = 0,                                        ///< extension version
+        .family         = NFPROTO_IPV4,                             ///< family (here: ipv4)
+        .target         = seng_mark_tg,                             ///< target function, called per packet
+        .checkentry     = seng_mark_tg_check,                       ///< check function, called upon addition of SENGMARK rules
+        .destroy        = seng_mark_tg_destroy,                     ///< destroy function, called upon removal of SENGMARK rules
+        .me             = THIS_MODULE,                              ///< module identifier
+        .targetsize     = XT_ALIGN(sizeof(struct seng_mark_tginfo)), ///< rule size
+    },
+    {
+        .name           = "SENGMARK",                               ///< extension name
+        .revision       = 0,                                        ///< extension version
+        .family         = NFPROTO_IPV6,                             ///< family (here: ipv6)
+        .target         = seng_mark_tg,                             ///< target function, called per packet
+        .checkentry     = seng_mark_tg_check,                       ///< check function, called upon addition of SENGMARK rules
+        .destroy        = seng_mark_tg_destroy,                     ///< destroy function, called upon removal of SENGMARK rules
+        .me             = THIS_MODULE,                              ///< module identifier
+        .targetsize     = XT_ALIGN(sizeof(struct seng_mark_tginfo)), ///< rule size
+    },
 };
 
 /**
  * @brief kernel module init
  *
- * Called upon module insertion. Registers against ip_tables and generic netlink.
+ * Called upon module insertion. Registers against ip_tables, ip6tables and generic netlink.
  *
  * @return status code
  * */
 int seng_mt_init(void) {
     int result;
-    if ((result = xt_register_match(&seng_mt4_reg)) < 0) printk(KERN_ERR "xt_seng: Registering against ip_tables failed.\n");
-    genl_register_family(&genl_seng_family);
+    if (ct_cache && (ct_cache_label % 32 || ct_cache_label > NF_CT_LABELS_MAX_SIZE * BITS_PER_BYTE - SENG_CT_LABEL_BITS)) {
+        printk(KERN_ERR "xt_seng: Invalid ct_cache_label %u.\n", ct_cache_label);
+        return -EINVAL;
+    }
+    if ((result = metadb_init()) < 0) {
+        printk(KERN_ERR "xt_seng: Initializing the database failed.\n");
+        return result;
+    }
+    if ((result = xt_register_matches(seng_mt_reg, ARRAY_SIZE(seng_mt_reg))) < 0) {
+        printk(KERN_ERR "xt_seng: Registering against ip_tables/ip6tables failed.\n");
+        goto err_matches;
+    }
+    if ((result = xt_register_targets(seng_tg_reg, ARRAY_SIZE(seng_tg_reg))) < 0) {
+        printk(KERN_ERR "xt_seng: Registering the targets failed.\n");
+        goto err_targets;
+    }
+    if ((result = genl_register_family(&genl_seng_family)) < 0) {
+        printk(KERN_ERR "xt_seng: Registering against generic netlink failed.\n");
+        goto err_genl;
+    }
+    if ((result = seng_stats_init()) < 0) {
+        printk(KERN_ERR "xt_seng: Creating the statistics file failed.\n");
+        goto err_stats;
+    }
     printk(KERN_INFO "xt_seng: Insertion successful.\n");
+    return 0;
+
+err_stats:
+    genl_unregister_family(&genl_seng_family);
+err_genl:
+    xt_unregister_targets(seng_tg_reg, ARRAY_SIZE(seng_tg_reg));
+err_targets:
+    xt_unregister_matches(seng_mt_reg, ARRAY_SIZE(seng_mt_reg));
+err_matches:
+    metadb_exit();
     return result;
 }
 
@@ -214,9 +946,14 @@ int seng_mt_init(void) {
  * Also cleans up the remainings of the hash table.
  * */
 void seng_mt_exit(void) {
-    xt_unregister_match(&seng_mt4_reg);
+    seng_stats_exit();
+    xt_unregister_targets(seng_tg_reg, ARRAY_SIZE(seng_tg_reg));
+    xt_unregister_matches(seng_mt_reg, ARRAY_SIZE(seng_mt_reg));
     genl_unregister_family(&genl_seng_family);
-    del_all_enclaves();
+    metadb_exit();
+
+    // wait for the pending deferred frees
+    rcu_barrier();
     printk(KERN_INFO "xt_seng: Removal successful.\n");
 }
 
@@ -1,12 +1,18 @@
 #include <linux/kernel.h>
+#include <linux/version.h>
 #include <linux/module.h>
 
 #include <linux/netlink.h>
 #include <net/genetlink.h>
 
+#include <net/netfilter/nf_conntrack.h>
+
+#include <linux/slab.h> //kmalloc_array
+
 #include "xt_seng.h"
 #include "xt_seng_metadb.h"
 #include "priv_xt_seng_genl.h"
+#include "xt_seng_trace.h"
 
 struct nla_policy genl_seng_policy[XT_SENG_ATTR_MAX+1] = {
 
@@ -21,16 +27,74 @@ struct nla_policy genl_seng_policy[XT_SENG_ATTR_MAX+1] = {
     },
 
     [XT_SENG_ATTR_CAT] = {
-        .type = NLA_STRING,
-        .len = MAX_CAT_NAME_LENGTH
+        .type = NLA_NUL_STRING,
+        .len = MAX_CAT_NAME_LENGTH - 1
     },
 
     [XT_SENG_ATTR_ENC] = {
         .type = NLA_U32,
         .len = sizeof(uint32_t)
     },
+
+    [XT_SENG_ATTR_SUBNET] = {
+        .type = NLA_U32,
+        .len = sizeof(uint32_t)
+    },
+
+    [XT_SENG_ATTR_PREFIX] = {
+        .type = NLA_U32,
+        .len = sizeof(uint32_t)
+    },
+
+    [XT_SENG_ATTR_BATCH] = {
+        .type = NLA_NESTED,
+    },
+
+    [XT_SENG_ATTR_ENTRY] = {
+        .type = NLA_NESTED,
+    },
+
+    [XT_SENG_ATTR_CATS] = {
+        .type = NLA_NESTED,
+    },
+
+    [XT_SENG_ATTR_ENC6] = {
+        .type = NLA_BINARY,
+        .len = sizeof(struct in6_addr)
+    },
+
+    [XT_SENG_ATTR_HOST6] = {
+        .type = NLA_BINARY,
+        .len = sizeof(struct in6_addr)
+    },
+
+    [XT_SENG_ATTR_VERDICT] = {
+        .type = NLA_U32,
+        .len = sizeof(uint32_t)
+    },
+
+    [XT_SENG_ATTR_MARK] = {
+        .type = NLA_U32,
+        .len = sizeof(uint32_t)
+    },
+
+    [XT_SENG_ATTR_ADD] = { .type = NLA_FLAG },
+    [XT_SENG_ATTR_RMV] = { .type = NLA_FLAG },
+    [XT_SENG_ATTR_FLUSH] = { .type = NLA_FLAG },
+    [XT_SENG_ATTR_STAGE_BEGIN] = { .type = NLA_FLAG },
+    [XT_SENG_ATTR_STAGE_COMMIT] = { .type = NLA_FLAG },
+    [XT_SENG_ATTR_STAGE_ABORT] = { .type = NLA_FLAG },
+    [XT_SENG_ATTR_STAGED] = { .type = NLA_FLAG },
+    [XT_SENG_ATTR_CT_FLUSH] = { .type = NLA_FLAG },
+    [XT_SENG_ATTR_POLICY] = { .type = NLA_FLAG },
 };
 
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 2, 0)
+#define seng_nla_parse_nested(tb, maxtype, nla, policy) nla_parse_nested_deprecated(tb, maxtype, nla, policy, NULL)
+#else
+#define seng_nla_parse_nested(tb, maxtype, nla, policy) nla_parse_nested(tb, maxtype, nla, policy, NULL)
+#endif
+
 /**
  * @brief defines generic netlink callbacks
  *
@@ -39,77 +103,594 @@ struct nla_policy genl_seng_policy[XT_SENG_ATTR_MAX+1] = {
 const struct genl_ops genl_seng_ops[] = {
         {
                 .cmd = GENL_XT_SENG_MSG,
-                //.policy = genl_seng_policy,     ///< policy
+#if LINUX_VERSION_CODE < KERNEL_VERSION(5, 2, 0)
+                .policy = genl_seng_policy,     ///< policy
+#else
+                .validate = GENL_DONT_VALIDATE_STRICT | GENL_DONT_VALIDATE_DUMP, ///< libnl does not flag nested attributes
+#endif
+                .flags = GENL_UNS_ADMIN_PERM,   ///< rewrites the database and deletes conntrack entries
                 .doit = seng_nl_recv_msg,       ///< generic netlink callback function to receive messages
                 .dumpit = NULL,
         },
+        {
+                .cmd = GENL_XT_SENG_DUMP,
+                .flags = GENL_UNS_ADMIN_PERM,   ///< exposes the whole database
+                .dumpit = seng_nl_dump_enclaves,///< generic netlink callback function to dump all enclaves
+        },
 };
 
 /**
  * @brief defines a generic netlink multicast group to communicate via generic netlink
+ *
+ * The events expose the whole database like the dump, i.e., joining the group requires CAP_NET_ADMIN
+ * in the user namespace of the network namespace.
  * */
 const struct genl_multicast_group genl_seng_mcgrps[] = {
-        [GENL_SENG_MCGRP0] = { .name = GENL_SENG_MCGRP_NAME, },
+        [GENL_SENG_MCGRP0] = {
+                .name = GENL_SENG_MCGRP_NAME,
+#ifdef GENL_MCAST_CAP_NET_ADMIN
+                .flags = GENL_MCAST_CAP_NET_ADMIN,  ///< exposes the whole database
+#endif
+        },
 };
 
+#if !defined(GENL_MCAST_CAP_NET_ADMIN) && LINUX_VERSION_CODE < KERNEL_VERSION(5, 8, 0)
+/**
+ * @brief checks if the caller may join a multicast group of the family
+ *
+ * Kernels before 5.8 have no group flags, but call the family on bind.
+ * Kernels from 5.8 without GENL_MCAST_CAP_NET_ADMIN cannot restrict the group (see seng_events_open()).
+ *
+ * @param[in] net       the network namespace of the socket
+ * @param[in] group     the multicast group of the family
+ *
+ * @return 0 if the caller holds CAP_NET_ADMIN, else -EPERM
+ * */
+static int seng_mcast_bind (struct net* net, int group) {
+    return ns_capable(net->user_ns, CAP_NET_ADMIN) ? 0 : -EPERM;
+}
+#endif
+
 struct genl_family genl_seng_family = {
         .name = GENL_SENG_FAMILY_NAME,              ///< family name
         .version = 1,                               ///< family version
         .maxattr = XT_SENG_ATTR_MAX,                ///< amount of attributes
-        .netnsok = false,
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 2, 0)
+        .policy = genl_seng_policy,                 ///< policy of all operations
+#endif
+        .netnsok = true,                            ///< operates on the database of the caller's namespace
         .module = THIS_MODULE,                      ///< this module
         .ops = genl_seng_ops,                       ///< operations = callback functions and policy
         .n_ops = ARRAY_SIZE(genl_seng_ops),         ///< amount of operations
         .mcgrps = genl_seng_mcgrps,                 ///< all multicast groups
         .n_mcgrps = ARRAY_SIZE(genl_seng_mcgrps),   ///< amount of multicast groups
+#if !defined(GENL_MCAST_CAP_NET_ADMIN) && LINUX_VERSION_CODE < KERNEL_VERSION(5, 8, 0)
+        .mcast_bind = seng_mcast_bind,              ///< restricts the multicast group
+#endif
 };
 
 /**
- * @brief multicasts a given signal via generic netlink
- *
- * Multicasts a given signal to the multicast group via generic netlink.
+ * @brief request attributes copied into events
+ * */
+static const int seng_event_attrs[] = {
+    XT_SENG_ATTR_ENC, XT_SENG_ATTR_APP, XT_SENG_ATTR_HOST, XT_SENG_ATTR_CAT, XT_SENG_ATTR_SUBNET, XT_SENG_ATTR_PREFIX,
+    XT_SENG_ATTR_ENC6, XT_SENG_ATTR_HOST6,
+};
+
+/**
+ * @brief multicasts a change of the active database via generic netlink
  *
- * @param[in] signal    the signal to be sent
+ * Copies the attributes of the change from the request, so events are as compact as the requests.
+ * Must be called with the namespace mutex held, which keeps the events in the order of the changes.
+ * Changes of the staged database and changes without listeners are skipped.
+ * Events are best effort - subscribers detect losses by a full receive buffer and re-dump.
  *
- * @return 0 for success, all other values for failure
+ * @param[in] net       the network namespace
+ * @param[in] db        the changed database
+ * @param[in] type      the @link seng_event_type event type @endlink
+ * @param[in] attrs     the parsed request attributes (optional)
  * */
-int send_mc_signal (int signal) {
-    void *hdr;
-    int res;
-    struct sk_buff* skb = genlmsg_new(NLMSG_DEFAULT_SIZE, GFP_KERNEL);
+static void seng_notify (struct net* net, const struct seng_metadb* db, uint32_t type, struct nlattr** attrs) {
+    struct sk_buff* skb;
+    void* hdr;
+    unsigned int i;
 
+    if (db != metadb_writer(seng_pernet(net))) return;
+    if (!genl_has_listeners(&genl_seng_family, net, GENL_SENG_MCGRP0)) return;
+
+    skb = genlmsg_new(NLMSG_DEFAULT_SIZE, GFP_KERNEL);
     if (!skb) {
-        printk(KERN_ERR "xt_seng: Unable to allocate skb!");
-        return -1;
+        pr_err_ratelimited("xt_seng: Unable to allocate skb!\n");
+        return;
     }
 
-    hdr = genlmsg_put(skb, 0, 0, &genl_seng_family, GFP_KERNEL, GENL_XT_SENG_MSG);
+    hdr = genlmsg_put(skb, 0, 0, &genl_seng_family, 0, GENL_XT_SENG_EVENT);
     if (!hdr) {
-        printk(KERN_ERR "xt_seng: Unable to generate msg!");
+        pr_err_ratelimited("xt_seng: Unable to generate msg!\n");
         goto fail;
     }
 
-    res = nla_put_flag(skb, signal);
-    if (res) {
-        printk(KERN_ERR "xt_seng: Error setting flag!");
-        goto fail;
+    if (nla_put_u32(skb, XT_SENG_ATTR_EVENT, type)) goto cancel;
+
+    for (i = 0; attrs && i < ARRAY_SIZE(seng_event_attrs); i++) {
+        const struct nlattr* attr = attrs[seng_event_attrs[i]];
+        if (attr && nla_put(skb, seng_event_attrs[i], nla_len(attr), nla_data(attr))) goto cancel;
     }
 
     genlmsg_end(skb, hdr);
-    genlmsg_multicast(&genl_seng_family, skb, 0, 0, GFP_KERNEL);
+    // consumes the skb; -ESRCH only means that the last listener left meanwhile
+    genlmsg_multicast_netns(&genl_seng_family, net, skb, 0, GENL_SENG_MCGRP0, GFP_KERNEL);
+    return;
+
+    cancel:
+        pr_err_ratelimited("xt_seng: Event does not fit into msg!\n");
+        genlmsg_cancel(skb, hdr);
+    fail:
+        nlmsg_free(skb);
+}
+
+/**
+ * @brief puts one dumped enclave into the dump message
+ *
+ * Must be called with the namespace mutex held.
+ *
+ * @param[in] skb       the dump message
+ * @param[in] cb        the netlink dump callback
+ * @param[in] db        the database
+ * @param[in] e         the enclave
+ *
+ * @return 0 on success, -EMSGSIZE if the message is full
+ * */
+static int put_dump_enclave (struct sk_buff* skb, struct netlink_callback* cb, struct seng_metadb* db, const struct enclave* e) {
+    struct nlmsghdr* nlh = (struct nlmsghdr *) skb_tail_pointer(skb);
+    struct nlattr* cats;
+    unsigned int cat_id;
+    void* hdr;
+
+    hdr = genlmsg_put(skb, NETLINK_CB(cb->skb).portid, cb->nlh->nlmsg_seq, &genl_seng_family, NLM_F_MULTI, GENL_XT_SENG_DUMP);
+    if (!hdr) return -EMSGSIZE;
+
+    // flags the message with NLM_F_DUMP_INTR if the database changed since the previous part
+    nl_dump_check_consistent(cb, nlh);
+
+    if (e->family == AF_INET6) {
+        if (nla_put(skb, XT_SENG_ATTR_ENC6, sizeof(e->enclave_ip6), &e->enclave_ip6) ||
+            nla_put(skb, XT_SENG_ATTR_HOST6, sizeof(e->host_ip6), &e->host_ip6)) goto cancel;
+    } else {
+        if (nla_put_u32(skb, XT_SENG_ATTR_ENC, e->enclave_ip) ||
+            nla_put_u32(skb, XT_SENG_ATTR_HOST, e->host_ip)) goto cancel;
+    }
 
-    if (res < 0) printk(KERN_ERR "xt_seng: Error while sending!\n");
+    if (nla_put(skb, XT_SENG_ATTR_APP, SGX_HASH_SIZE, e->a->app_hash)) goto cancel;
 
+    cats = nla_nest_start(skb, XT_SENG_ATTR_CATS);
+    if (!cats) goto cancel;
+
+    for_each_set_bit (cat_id, e->a->categories, SENG_MAX_CATEGORIES) {
+        if (nla_put_string(skb, XT_SENG_ATTR_CAT, get_cat_name(db->cats, cat_id))) goto cancel;
+    }
+
+    nla_nest_end(skb, cats);
+    genlmsg_end(skb, hdr);
     return 0;
 
-    fail:
+    cancel:
         genlmsg_cancel(skb, hdr);
-        nlmsg_free(skb);
-        return -1;
+        return -EMSGSIZE;
+}
+
+int seng_nl_dump_enclaves(struct sk_buff *skb, struct netlink_callback* cb) {
+    struct seng_net* sn = seng_pernet(sock_net(skb->sk));
+    struct seng_metadb* db;
+    struct enclave* e;
+    // cursor: next slot number to be dumped
+    int slot = cb->args[0];
+    int err = 0;
+
+    mutex_lock(&sn->mutex);
+
+    db = metadb_writer(sn);
+    // 0 disables the consistency check
+    cb->seq = db->seq + 1;
+
+    while ((e = next_enclave(db, &slot))) {
+        if ((err = put_dump_enclave(skb, cb, db, e))) break;
+        slot++;
+    }
+
+    cb->args[0] = slot;
+
+    mutex_unlock(&sn->mutex);
+
+    // an enclave which does not even fit into an empty part would otherwise end the dump silently
+    if (err && !skb->len) return err;
+
+    return skb->len;
+}
+
+/**
+ * @brief state of a conntrack flush
+ * */
+struct seng_ct_flush {
+    union nf_inet_addr enclave_ip;  ///< the enclave
+    uint8_t family;                 ///< address family of the enclave (NFPROTO_IPV4 or NFPROTO_IPV6)
+    unsigned int removed;           ///< amount of matched conntrack entries
+};
+
+/**
+ * @brief selects the conntrack entries of an enclave
+ *
+ * Matches all entries of the enclave's family with the enclave as source or destination of either direction
+ * (i.e., also NAT'ed ones).
+ *
+ * @param[in] ct        the conntrack entry
+ * @param[in] data      the flush state
+ *
+ * @return 1 if the entry is to be deleted, else 0
+ * */
+static int seng_ct_flush_iter (struct nf_conn* ct, void* data) {
+    struct seng_ct_flush* flush = data;
+    const struct nf_conntrack_tuple* orig = &ct->tuplehash[IP_CT_DIR_ORIGINAL].tuple;
+    const struct nf_conntrack_tuple* repl = &ct->tuplehash[IP_CT_DIR_REPLY].tuple;
+    const union nf_inet_addr* ip = &flush->enclave_ip;
+
+    if (nf_ct_l3num(ct) != flush->family) return 0;
+
+    if (flush->family == NFPROTO_IPV4) {
+        if (orig->src.u3.ip != ip->ip && orig->dst.u3.ip != ip->ip && repl->src.u3.ip != ip->ip && repl->dst.u3.ip != ip->ip) return 0;
+    } else {
+        if (!nf_inet_addr_cmp(&orig->src.u3, ip) && !nf_inet_addr_cmp(&orig->dst.u3, ip) &&
+            !nf_inet_addr_cmp(&repl->src.u3, ip) && !nf_inet_addr_cmp(&repl->dst.u3, ip)) return 0;
+    }
+
+    flush->removed++;
+    return 1;
+}
+
+/**
+ * @brief deletes all conntrack entries of an enclave
+ *
+ * Prevents the exploitation of stale entries after the ip of a removed enclave is re-assigned.
+ * Walks the conntrack table in the kernel instead of dumping it to user space.
+ *
+ * @param[in] net           the network namespace
+ * @param[in] enclave_ip    the removed enclave
+ * @param[in] family        address family of the enclave (NFPROTO_IPV4 or NFPROTO_IPV6)
+ *
+ * @return the amount of deleted entries
+ * */
+static unsigned int seng_ct_flush_enclave (struct net* net, const union nf_inet_addr* enclave_ip, uint8_t family) {
+    struct seng_ct_flush flush = { .enclave_ip = *enclave_ip, .family = family, .removed = 0 };
+
+    nf_ct_iterate_cleanup_net(net, seng_ct_flush_iter, &flush, 0, 0);
+
+    return flush.removed;
+}
+
+/**
+ * @brief state of a conntrack flush after a commit
+ * */
+struct seng_ct_stale {
+    struct seng_metadb* old;        ///< the replaced generation
+    struct seng_metadb* new;        ///< the active generation
+    unsigned int removed;           ///< amount of matched conntrack entries
+};
+
+/**
+ * @brief checks if an address is a stale enclave of the replaced generation
+ *
+ * @param[in] stale     the flush state
+ * @param[in] family    address family of the conntrack entry (NFPROTO_IPV4 or NFPROTO_IPV6)
+ * @param[in] addr      the address
+ *
+ * @return true if the address belongs to a stale enclave, else false
+ * */
+static bool seng_ct_addr_stale (const struct seng_ct_stale* stale, uint8_t family, const union nf_inet_addr* addr) {
+    const struct enclave* e;
+
+    e = (family == NFPROTO_IPV4) ? find_enclave(stale->old, addr->ip) : find_enclave6(stale->old, &addr->in6);
+    return e && metadb_enclave_stale(stale->new, e);
+}
+
+/**
+ * @brief selects the conntrack entries of stale enclaves
+ *
+ * Matches all entries with a stale enclave as source or destination of either direction (i.e., also NAT'ed ones).
+ *
+ * @param[in] ct        the conntrack entry
+ * @param[in] data      the flush state
+ *
+ * @return 1 if the entry is to be deleted, else 0
+ * */
+static int seng_ct_stale_iter (struct nf_conn* ct, void* data) {
+    struct seng_ct_stale* stale = data;
+    const struct nf_conntrack_tuple* orig = &ct->tuplehash[IP_CT_DIR_ORIGINAL].tuple;
+    const struct nf_conntrack_tuple* repl = &ct->tuplehash[IP_CT_DIR_REPLY].tuple;
+    uint8_t family = nf_ct_l3num(ct);
+    bool match;
+
+    if (family != NFPROTO_IPV4 && family != NFPROTO_IPV6) return 0;
+
+    rcu_read_lock();
+    match = seng_ct_addr_stale(stale, family, &orig->src.u3) || seng_ct_addr_stale(stale, family, &orig->dst.u3) ||
+            seng_ct_addr_stale(stale, family, &repl->src.u3) || seng_ct_addr_stale(stale, family, &repl->dst.u3);
+    rcu_read_unlock();
+
+    if (!match) return 0;
+
+    stale->removed++;
+    return 1;
+}
+
+/**
+ * @brief deletes all conntrack entries of the enclaves which a commit removed or re-assigned
+ *
+ * The counterpart of the conntrack flush of single removals for staged databases, i.e., a resync does not
+ * leave stale entries behind either. Walks the conntrack table once, and only if any enclave became stale.
+ * Must be called with the namespace mutex held.
+ *
+ * @param[in] net       the network namespace
+ * @param[in] old       the replaced generation
+ * @param[in] new       the active generation
+ *
+ * @return the amount of deleted entries
+ * */
+static unsigned int seng_ct_flush_stale (struct net* net, struct seng_metadb* old, struct seng_metadb* new) {
+    struct seng_ct_stale stale = { .old = old, .new = new, .removed = 0 };
+    struct enclave* e;
+    bool any = false;
+
+    rcu_read_lock();
+    list_for_each_entry (e, &old->enclave_list, list_node) {
+        if ((any = metadb_enclave_stale(new, e))) break;
+    }
+    rcu_read_unlock();
+
+    if (any) nf_ct_iterate_cleanup_net(net, seng_ct_stale_iter, &stale, 0, 0);
+
+    return stale.removed;
+}
+
+/**
+ * @brief an enclave entry of a batch
+ * */
+struct seng_batch_entry {
+    const struct nlattr* attr;      ///< the nested XT_SENG_ATTR_ENTRY attribute
+    bool new_cat;                   ///< the entry added the category to its app
+};
+
+/**
+ * @brief parses and checks a single enclave entry of a batch
+ *
+ * @param[in] entry     the nested XT_SENG_ATTR_ENTRY attribute
+ * @param[out] tb       the parsed attributes of the entry
+ *
+ * @return 0 on success, else a negative error code
+ * */
+static int parse_batch_entry (const struct nlattr* entry, struct nlattr** tb) {
+    if (seng_nla_parse_nested(tb, XT_SENG_ATTR_MAX, entry, genl_seng_policy)) return -EINVAL;
+
+    if (!tb[XT_SENG_ATTR_ENC] || !tb[XT_SENG_ATTR_APP] || !tb[XT_SENG_ATTR_HOST]) return -EINVAL;
+    if (nla_len(tb[XT_SENG_ATTR_APP]) != SGX_HASH_SIZE) return -EINVAL;
+
+    return 0;
+}
+
+/**
+ * @brief adds a single enclave entry of a batch
+ *
+ * Leaves nothing behind if the entry fails.
+ * Must be called with the namespace mutex held.
+ *
+ * @param[in] db        the database
+ * @param[in,out] be    the entry, records whether the entry added its category to the app
+ *
+ * @return 0 on success, else a negative error code
+ * */
+static int add_batch_entry (struct seng_metadb* db, struct seng_batch_entry* be) {
+    struct nlattr* tb[XT_SENG_ATTR_MAX + 1];
+    struct enclave* e;
+    const char* cat_name;
+    int cat_id;
+
+    if (parse_batch_entry(be->attr, tb)) return -EINVAL;
+
+    e = add_enclave(db, nla_get_u32(tb[XT_SENG_ATTR_ENC]), nla_data(tb[XT_SENG_ATTR_APP]), nla_get_u32(tb[XT_SENG_ATTR_HOST]));
+    if (!e) return -EINVAL;
+
+    be->new_cat = false;
+    if (!tb[XT_SENG_ATTR_CAT]) return 0;
+
+    cat_name = nla_data(tb[XT_SENG_ATTR_CAT]);
+    cat_id = find_cat_id(db->cats, cat_name);
+    be->new_cat = cat_id < 0 || !match_category(e->a, cat_id);
+
+    if (!add_cat_to_app(db, e->a, cat_name)) {
+        del_enclave(db, nla_get_u32(tb[XT_SENG_ATTR_ENC]));
+        return -EINVAL;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief reverts a single added enclave entry of a batch
+ *
+ * Removes the enclave and the category which the entry added to its app.
+ * Must be called with the namespace mutex held, in reverse order of the additions.
+ *
+ * @param[in] db        the database
+ * @param[in] be        the entry
+ * */
+static void undo_batch_entry (struct seng_metadb* db, const struct seng_batch_entry* be) {
+    struct nlattr* tb[XT_SENG_ATTR_MAX + 1];
+    struct app* a;
+
+    if (parse_batch_entry(be->attr, tb)) return;
+
+    if (be->new_cat && (a = lookup_app_hash(db, nla_data(tb[XT_SENG_ATTR_APP])))) {
+        del_cat_from_app(db, a, nla_data(tb[XT_SENG_ATTR_CAT]));
+    }
+
+    del_enclave(db, nla_get_u32(tb[XT_SENG_ATTR_ENC]));
+}
+
+/**
+ * @brief adds a batch of enclaves
+ *
+ * The batch is all-or-nothing: all entries are checked before the first change, and if an entry still
+ * fails (e.g., a duplicate within the batch or no memory), the entries added before are reverted.
+ * The conntrack entries of reverted enclaves of the active database are deleted, as the packet path might
+ * have resolved them meanwhile. The events of the entries are only sent once the whole batch succeeded.
+ * Must be called with the namespace mutex held.
+ *
+ * @param[in] net       the network namespace
+ * @param[in] sn        the state of the namespace
+ * @param[in] db        the database
+ * @param[in] batch     the XT_SENG_ATTR_BATCH attribute
+ *
+ * @return 0 on success, else a negative error code (nothing has been added)
+ * */
+static int seng_nl_batch (struct net* net, struct seng_net* sn, struct seng_metadb* db, const struct nlattr* batch) {
+    struct nlattr* tb[XT_SENG_ATTR_MAX + 1];
+    struct seng_batch_entry* entries;
+    const struct nlattr* entry;
+    bool dup;
+    int n = 0, i, rem, err = 0;
+
+    nla_for_each_nested(entry, batch, rem) {
+        if (++n > SENG_BATCH_MAX_ENTRIES) return -E2BIG;
+        if ((err = parse_batch_entry(entry, tb))) return err;
+
+        rcu_read_lock();
+        dup = find_enclave(db, nla_get_u32(tb[XT_SENG_ATTR_ENC])) != NULL;
+        rcu_read_unlock();
+        if (dup) return -EEXIST;
+    }
+
+    if (!n) return 0;
+
+    entries = kmalloc_array(n, sizeof(*entries), GFP_KERNEL);
+    if (!entries) return -ENOMEM;
+
+    i = 0;
+    nla_for_each_nested(entry, batch, rem) {
+        entries[i].attr = entry;
+        if ((err = add_batch_entry(db, &entries[i]))) break;
+        i++;
+    }
+
+    if (err) {
+        int failed = i;
+
+        while (i--) undo_batch_entry(db, &entries[i]);
+
+        // the failed entry itself is gone already, but might have been visible as well
+        for (i = 0; i <= failed && db == metadb_writer(sn); i++) {
+            union nf_inet_addr ip;
+
+            if (parse_batch_entry(entries[i].attr, tb)) continue;
+            ip.ip = nla_get_u32(tb[XT_SENG_ATTR_ENC]);
+            seng_ct_flush_enclave(net, &ip, NFPROTO_IPV4);
+        }
+    } else {
+        for (i = 0; i < n; i++) {
+            if (!parse_batch_entry(entries[i].attr, tb)) seng_notify(net, db, SENG_EVENT_ENCLAVE_ADD, tb);
+        }
+    }
+
+    trace_seng_op("batch", err ? err : n);
+
+    kfree(entries);
+    return err;
+}
+
+/**
+ * @brief handles an operation on the policy map
+ *
+ * Adds/replaces (XT_SENG_ATTR_ADD) or removes (XT_SENG_ATTR_RMV) the entry of an app (XT_SENG_ATTR_APP)
+ * or a category (XT_SENG_ATTR_CAT), or removes all entries (XT_SENG_ATTR_FLUSH).
+ * Must be called with the namespace mutex held.
+ *
+ * @param[in] p         the policy map of the namespace
+ * @param[in] attrs     the parsed request attributes
+ *
+ * @return 0 on success, else a negative error code
+ * */
+static int seng_nl_policy (struct seng_policy* p, struct nlattr** attrs) {
+    char cat_name[MAX_CAT_NAME_LENGTH];
+    const uint8_t* app_hash = NULL;
+    const char* cat = NULL;
+    uint32_t verdict = SENG_POLICY_CONTINUE;
+    uint32_t mark;
+
+    if (attrs[XT_SENG_ATTR_FLUSH]) {
+        seng_policy_flush(p);
+        trace_seng_op("policy_flush", 0);
+        return 0;
+    }
+
+    if (attrs[XT_SENG_ATTR_APP]) {
+        if (nla_len(attrs[XT_SENG_ATTR_APP]) != SGX_HASH_SIZE) return -EINVAL;
+        app_hash = nla_data(attrs[XT_SENG_ATTR_APP]);
+    } else if (attrs[XT_SENG_ATTR_CAT]) {
+        nla_strlcpy(cat_name, attrs[XT_SENG_ATTR_CAT], sizeof(cat_name));
+        cat = cat_name;
+    } else {
+        return -EINVAL;
+    }
+
+    if (attrs[XT_SENG_ATTR_RMV]) return seng_policy_del(p, app_hash, cat) ? 0 : -ENOENT;
+    if (!attrs[XT_SENG_ATTR_ADD]) return -EINVAL;
+
+    if (attrs[XT_SENG_ATTR_VERDICT]) verdict = nla_get_u32(attrs[XT_SENG_ATTR_VERDICT]);
+    if (verdict >= __SENG_POLICY_MAX) return -EINVAL;
+    if (attrs[XT_SENG_ATTR_MARK]) mark = nla_get_u32(attrs[XT_SENG_ATTR_MARK]);
+
+    return seng_policy_set(p, app_hash, cat, verdict, attrs[XT_SENG_ATTR_MARK] ? &mark : NULL);
 }
 
 int seng_nl_recv_msg(struct sk_buff *skb, struct genl_info* info) {
+    struct net* net = genl_info_net(info);
+    struct seng_net* sn = seng_pernet(net);
+    struct seng_metadb* db;
     bool status;
+    int err = -EINVAL;
+
+    // single writer per namespace; the packet path keeps reading under RCU meanwhile
+    mutex_lock(&sn->mutex);
+
+    if (info->attrs[XT_SENG_ATTR_STAGE_BEGIN]) {
+        if (metadb_stage_begin(sn)) goto error;
+        trace_seng_op("stage_begin", 0);
+        goto success;
+    } else if (info->attrs[XT_SENG_ATTR_STAGE_COMMIT]) {
+        struct seng_metadb* old = metadb_stage_commit(sn);
+        unsigned int removed;
+
+        if (IS_ERR(old)) goto error;
+        seng_notify(net, metadb_writer(sn), SENG_EVENT_SWAP, NULL);
+        trace_seng_op("stage_commit", 0);
+
+        // the conntrack entries are flushed regardless of the flush mode, user space does not know the difference
+        removed = seng_ct_flush_stale(net, old, metadb_writer(sn));
+        trace_seng_op("ct_flush", removed);
+        metadb_retire(old);
+        goto success;
+    } else if (info->attrs[XT_SENG_ATTR_STAGE_ABORT]) {
+        metadb_stage_abort(sn);
+        trace_seng_op("stage_abort", 0);
+        goto success;
+    } else if (info->attrs[XT_SENG_ATTR_POLICY]) {
+        if (seng_nl_policy(&sn->policy, info->attrs)) goto error;
+        goto success;
+    }
+
+    db = info->attrs[XT_SENG_ATTR_STAGED] ? metadb_staged(sn) : metadb_writer(sn);
+    if (!db) {
+        trace_seng_op("no_stage", -ENOENT);
+        goto error;
+    }
 
     if (info->attrs[XT_SENG_ATTR_ENC] && info->attrs[XT_SENG_ATTR_APP] && info->attrs[XT_SENG_ATTR_HOST] && info->attrs[XT_SENG_ATTR_ADD]) {
 
@@ -123,29 +704,20 @@ int seng_nl_recv_msg(struct sk_buff *skb, struct genl_info* info) {
         host_ptr = (uint32_t *) nla_data(info->attrs[XT_SENG_ATTR_HOST]);
         if (!host_ptr) goto error;
 
-        e = add_enclave(*enc_ptr, nla_data(info->attrs[XT_SENG_ATTR_APP]), *host_ptr);
+        if (nla_len(info->attrs[XT_SENG_ATTR_APP]) != SGX_HASH_SIZE) goto error;
 
+        e = add_enclave(db, *enc_ptr, nla_data(info->attrs[XT_SENG_ATTR_APP]), *host_ptr);
 
-        if (!e) {
-            printk(KERN_DEBUG "xt_seng: Something went wrong while adding enclave!");
-            goto error;
-        }
 
-        if (info->attrs[XT_SENG_ATTR_CAT] && e) {
-            status = add_cat_to_app(e->a, (char *) nla_data(info->attrs[XT_SENG_ATTR_CAT]));
-            if (!status) {
-                printk(KERN_DEBUG "xt_seng: Something went wrong while adding category!");
-                goto error;
-            }
-            #ifdef DEBUG_SENGMOD
-            printk(KERN_DEBUG "xt_seng: Added - %i , %i, %s, %s", *enc_ptr, *host_ptr, (char *) nla_data(info->attrs[XT_SENG_ATTR_APP]), (char *) nla_data(info->attrs[XT_SENG_ATTR_CAT]));
-            #endif
-        } else {
-            #ifdef DEBUG_SENGMOD
-            printk(KERN_DEBUG "xt_seng: Added - %i , %i, %s", *enc_ptr, *host_ptr, (char *) nla_data(info->attrs[XT_SENG_ATTR_APP]));
-            #endif
+        trace_seng_enclave_add(NFPROTO_IPV4, enc_ptr, e ? 0 : -EINVAL);
+        if (!e) goto error;
+
+        if (info->attrs[XT_SENG_ATTR_CAT]) {
+            status = add_cat_to_app(db, e->a, (char *) nla_data(info->attrs[XT_SENG_ATTR_CAT]));
+            if (!status) goto error;
         }
 
+        seng_notify(net, db, SENG_EVENT_ENCLAVE_ADD, info->attrs);
         goto success;
 
     } else if (info->attrs[XT_SENG_ATTR_ENC]) {
@@ -154,12 +726,53 @@ int seng_nl_recv_msg(struct sk_buff *skb, struct genl_info* info) {
             uint32_t * enc_ptr = (uint32_t *) nla_data(info->attrs[XT_SENG_ATTR_ENC]);
             if (!enc_ptr) goto error;
 
-            del_enclave(*enc_ptr);
-            #ifdef DEBUG_SENGMOD
-            printk(KERN_DEBUG "xt_seng: enclave entry removed - %i \n", *enc_ptr);
-            #endif
+            // the conntrack entries are flushed even if the enclave was already gone
+            status = del_enclave(db, *enc_ptr);
+            trace_seng_enclave_rmv(NFPROTO_IPV4, enc_ptr, status ? 0 : -ENOENT);
+            if (status) seng_notify(net, db, SENG_EVENT_ENCLAVE_RMV, info->attrs);
+
+            if (info->attrs[XT_SENG_ATTR_CT_FLUSH] && db == metadb_writer(sn)) {
+                union nf_inet_addr ip = { .ip = *enc_ptr };
+                unsigned int removed = seng_ct_flush_enclave(net, &ip, NFPROTO_IPV4);
+                trace_seng_op("ct_flush", removed);
+            }
         } else {
-            printk(KERN_DEBUG "xt_seng: unknown operation");
+            trace_seng_op("unknown", -EINVAL);
+            goto error;
+        }
+        goto success;
+
+    } else if (info->attrs[XT_SENG_ATTR_ENC6]) {
+
+        union nf_inet_addr ip;
+        struct enclave* e;
+
+        if (nla_len(info->attrs[XT_SENG_ATTR_ENC6]) != sizeof(struct in6_addr)) goto error;
+        memcpy(&ip.in6, nla_data(info->attrs[XT_SENG_ATTR_ENC6]), sizeof(struct in6_addr));
+
+        if (info->attrs[XT_SENG_ATTR_ADD] && info->attrs[XT_SENG_ATTR_APP] && info->attrs[XT_SENG_ATTR_HOST6]) {
+            if (nla_len(info->attrs[XT_SENG_ATTR_HOST6]) != sizeof(struct in6_addr)) goto error;
+            if (nla_len(info->attrs[XT_SENG_ATTR_APP]) != SGX_HASH_SIZE) goto error;
+
+            e = add_enclave6(db, &ip.in6, nla_data(info->attrs[XT_SENG_ATTR_APP]), nla_data(info->attrs[XT_SENG_ATTR_HOST6]));
+            trace_seng_enclave_add(NFPROTO_IPV6, &ip.in6, e ? 0 : -EINVAL);
+            if (!e) goto error;
+
+            if (info->attrs[XT_SENG_ATTR_CAT] && !add_cat_to_app(db, e->a, (char *) nla_data(info->attrs[XT_SENG_ATTR_CAT]))) goto error;
+
+            seng_notify(net, db, SENG_EVENT_ENCLAVE_ADD, info->attrs);
+        } else if (info->attrs[XT_SENG_ATTR_RMV]) {
+            // the conntrack entries are flushed even if the enclave was already gone
+            status = del_enclave6(db, &ip.in6);
+            trace_seng_enclave_rmv(NFPROTO_IPV6, &ip.in6, status ? 0 : -ENOENT);
+            if (status) seng_notify(net, db, SENG_EVENT_ENCLAVE_RMV, info->attrs);
+
+            if (info->attrs[XT_SENG_ATTR_CT_FLUSH] && db == metadb_writer(sn)) {
+                unsigned int removed = seng_ct_flush_enclave(net, &ip, NFPROTO_IPV6);
+                trace_seng_op("ct_flush", removed);
+            }
+        } else {
+            trace_seng_op("unknown", -EINVAL);
             goto error;
         }
         goto success;
@@ -167,37 +780,60 @@ int seng_nl_recv_msg(struct sk_buff *skb, struct genl_info* info) {
     } else if (info->attrs[XT_SENG_ATTR_APP] && info->attrs[XT_SENG_ATTR_CAT]) {
 
         struct app* a;
-        a = lookup_app_hash(nla_data(info->attrs[XT_SENG_ATTR_APP]));
+        if (nla_len(info->attrs[XT_SENG_ATTR_APP]) != SGX_HASH_SIZE) goto error;
+        a = lookup_app_hash(db, nla_data(info->attrs[XT_SENG_ATTR_APP]));
         status = false;
 
         if (info->attrs[XT_SENG_ATTR_RMV] && a) {
-            status = del_cat_from_app(a, (char *) nla_data(info->attrs[XT_SENG_ATTR_CAT]));
-            #ifdef DEBUG_SENGMOD
-            printk(KERN_DEBUG "xt_seng: Removed - %s, %s", (char *) nla_data(info->attrs[XT_SENG_ATTR_APP]), (char *) nla_data(info->attrs[XT_SENG_ATTR_CAT]));
-            #endif
+            status = del_cat_from_app(db, a, (char *) nla_data(info->attrs[XT_SENG_ATTR_CAT]));
         } else if (info->attrs[XT_SENG_ATTR_ADD] && a) {
-            status = add_cat_to_app(a, (char *) nla_data(info->attrs[XT_SENG_ATTR_CAT]));
-            #ifdef DEBUG_SENGMOD
-            printk(KERN_DEBUG "xt_seng: Added - %s, %s", (char *) nla_data(info->attrs[XT_SENG_ATTR_APP]), (char *) nla_data(info->attrs[XT_SENG_ATTR_CAT]));
-            #endif
+            status = add_cat_to_app(db, a, (char *) nla_data(info->attrs[XT_SENG_ATTR_CAT]));
         }
 
-        if (!status) {
-            printk(KERN_DEBUG "xt_seng: Something went wrong while adding/deleting a category");
+        // add_cat_to_app()/del_cat_from_app() trace the outcome themselves
+        if (!status) goto error;
+
+        seng_notify(net, db, info->attrs[XT_SENG_ATTR_RMV] ? SENG_EVENT_CAT_RMV : SENG_EVENT_CAT_ADD, info->attrs);
+        goto success;
+    } else if (info->attrs[XT_SENG_ATTR_BATCH] && info->attrs[XT_SENG_ATTR_ADD]) {
+
+        // the whole batch is added under a single acquisition of the writer lock
+        err = seng_nl_batch(net, sn, db, info->attrs[XT_SENG_ATTR_BATCH]);
+        if (err) goto error;
+        goto success;
+
+    } else if (info->attrs[XT_SENG_ATTR_SUBNET]) {
+
+        if (info->attrs[XT_SENG_ATTR_ADD] && info->attrs[XT_SENG_ATTR_PREFIX]) {
+            uint32_t base = nla_get_u32(info->attrs[XT_SENG_ATTR_SUBNET]);
+            uint32_t prefix_len = nla_get_u32(info->attrs[XT_SENG_ATTR_PREFIX]);
+
+            if (set_enclave_subnet(db, base, prefix_len)) goto error;
+            seng_notify(net, db, SENG_EVENT_SUBNET_SET, info->attrs);
+            trace_seng_op("subnet_set", prefix_len);
+        } else if (info->attrs[XT_SENG_ATTR_RMV]) {
+            clear_enclave_subnet(db);
+            seng_notify(net, db, SENG_EVENT_SUBNET_CLEAR, NULL);
+            trace_seng_op("subnet_clear", 0);
+        } else {
+            trace_seng_op("unknown", -EINVAL);
             goto error;
         }
-
         goto success;
+
     } else if (info->attrs[XT_SENG_ATTR_FLUSH]) {
         //flush all entries upon flush signal
-        del_all_enclaves();
-        printk(KERN_DEBUG "xt_seng: flushed all entries!");
+        del_all_enclaves(db);
+        seng_notify(net, db, SENG_EVENT_FLUSH, NULL);
+        trace_seng_op("flush", 0);
         goto success;
     }
 
     success:
+        mutex_unlock(&sn->mutex);
         return 0;
 
     error:
-        return -EINVAL;
+        mutex_unlock(&sn->mutex);
+        return err;
 }
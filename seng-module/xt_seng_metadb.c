@@ -2,55 +2,172 @@
 #include <linux/module.h>
 
 #include <linux/slab.h> //kmalloc
+#include <linux/mm.h> //kvzalloc
+#include <linux/rculist.h>
+#include <linux/jhash.h>
+#include <linux/idr.h>
+#include <linux/log2.h>
+#include <linux/atomic.h>
+#include <linux/err.h>
+#include <net/netns/generic.h>
+#include <net/ipv6.h> //ipv6_addr_equal
 
 #include "xt_seng.h"
 #include "xt_seng_metadb.h"
+#include "xt_seng_trace.h"
+
+static unsigned int enclave_table_size = 256;
+module_param(enclave_table_size, uint, 0444);
+MODULE_PARM_DESC(enclave_table_size, "expected number of enclaves, used as initial size of the enclave hash table (default: 256)");
 
 /**
- * @brief a hash table for enclaves
+ * @brief parameters of the enclaves hash table
+ * */
+static const struct rhashtable_params enclave_params = {
+    .key_len = sizeof(uint32_t),
+    .key_offset = offsetof(struct enclave, enclave_ip),
+    .head_offset = offsetof(struct enclave, enclave_node),
+    .hashfn = jhash,
+    .automatic_shrinking = true,
+};
+
+/**
+ * @brief the hash function of the ipv6 enclaves hash table
+ *
+ * @param[in] data      the enclave ip
+ * @param[in] len       length of the enclave ip (unused)
+ * @param[in] seed      seed of the hash table
  *
- * This hash table is used to store the enclaves, sent by the user-space app.
- * The table uses 2^8 hash buckets.
+ * @return the hash
+ * */
+static u32 enclave6_hashfn (const void* data, u32 len, u32 seed) {
+    return jhash2(data, sizeof(struct in6_addr) / sizeof(u32), seed);
+}
+
+/**
+ * @brief parameters of the ipv6 enclaves hash table
  * */
-DEFINE_HASHTABLE(enclaves, 8);
-LIST_HEAD(apps);
+static const struct rhashtable_params enclave6_params = {
+    .key_len = sizeof(struct in6_addr),
+    .key_offset = offsetof(struct enclave, enclave_ip6),
+    .head_offset = offsetof(struct enclave, enclave_node),
+    .hashfn = enclave6_hashfn,
+    .automatic_shrinking = true,
+};
+
+/**
+ * @brief parameters of the apps hash table
+ * */
+static const struct rhashtable_params app_params = {
+    .key_len = SGX_HASH_SIZE,
+    .key_offset = offsetof(struct app, app_hash),
+    .head_offset = offsetof(struct app, hash_node),
+    .hashfn = seng_app_hashfn,
+    .automatic_shrinking = true,
+};
+
+/**
+ * @brief the last assigned database generation id
+ * */
+static atomic64_t metadb_gen = ATOMIC64_INIT(0);
+
+/// id of the per-namespace database state
+static unsigned int seng_net_id;
 
 //helper functions
 
+/**
+ * @brief advances the sequence counter of a database
+ *
+ * Must be called after enclaves have been published or unpublished, and before unpublished ones are freed.
+ *
+ * @param[in] db        the database
+ * */
+static void bump_seq (struct seng_metadb* db) {
+    // pairs with smp_rmb() in metadb_read_seq()
+    smp_wmb();
+    WRITE_ONCE(db->seq, db->seq + 1);
+}
+
+/**
+ * @brief returns the enclave subnet of a database on the writer side
+ *
+ * @param[in] db        the database
+ *
+ * @return the subnet or NULL if subnet mode is disabled
+ * */
+static struct enclave_subnet* writer_subnet (struct seng_metadb* db) {
+    return rcu_dereference_protected(db->subnet, lockdep_is_held(db->lock));
+}
+
+/**
+ * @brief checks if an ip is part of the given subnet
+ *
+ * @param[in] sn            the enclave subnet
+ * @param[in] enclave_ip    the ip to be checked (network byte order)
+ *
+ * @return true if the ip is part of the subnet, else false
+ * */
+static inline bool in_subnet (const struct enclave_subnet* sn, uint32_t enclave_ip) {
+    return (enclave_ip & sn->mask) == sn->base;
+}
+
+/**
+ * @brief returns the slot index of an ip inside the given subnet
+ *
+ * The ip must be part of the subnet (see in_subnet()).
+ *
+ * @param[in] sn            the enclave subnet
+ * @param[in] enclave_ip    the ip (network byte order)
+ *
+ * @return the slot index
+ * */
+static inline uint32_t subnet_idx (const struct enclave_subnet* sn, uint32_t enclave_ip) {
+    return ntohl(enclave_ip ^ sn->base);
+}
+
+/**
+ * @brief RCU callback freeing a retired enclave subnet
+ *
+ * @param[in] head      rcu head of the subnet
+ * */
+static void free_subnet_rcu (struct rcu_head* head) {
+    kvfree(container_of(head, struct enclave_subnet, rcu));
+}
+
 /**
  * @brief helps deleting a category in a given app
  *
  * Helps deleting a category in a given app.
  *
+ * @param[in] db                  the database of the app
  * @param[in] a                   the app to be deleted in
- * @param[in] cat_name            the category name to be deleted up
+ * @param[in] cat_id              the category id to be deleted
+ *
+ * @return true if the app had the category, else false
  * */
-void del_cat_helper (struct app* a, const char* cat_name) {
-    struct list_head *pos, *q;
-    struct cat* c;
+bool del_cat_helper (struct seng_metadb* db, struct app* a, uint16_t cat_id) {
+    if (!test_bit(cat_id, a->categories)) return false;
 
-    list_for_each_safe (pos, q, &(a->categories)) {
-        c = list_entry(pos, struct cat, cat_node);
-        if (strncmp(cat_name, c->category_name, MAX_CAT_NAME_LENGTH) == 0) {
-            list_del(&(c->cat_node));
-            kfree(c);
-            return;
-        }
-    }
+    clear_bit(cat_id, a->categories);
+    put_cat(db->cats, cat_id);
+    return true;
 }
 
 /**
- * @brief adds an app into the apps list
+ * @brief adds an app into the apps hash table
  *
- * Adds an app into the apps list or increases the reference counter of existing app.
+ * Adds an app into the apps hash table or increases the reference counter of existing app.
  *
+ * @param[in] db                   the database
  * @param[in] app_hash             the app hash to be added
  *
  * @return a pointer to the app, or null in case of out of memory
  * */
-struct app* add_app (const uint8_t* app_hash) {
+struct app* add_app (struct seng_metadb* db, const uint8_t* app_hash) {
     struct app* a;
-    a = lookup_app_hash(app_hash);
+    int err;
+    a = lookup_app_hash(db, app_hash);
 
     if (a) {
         a->reference_counter++;
@@ -60,19 +177,25 @@ struct app* add_app (const uint8_t* app_hash) {
     a = kmalloc(sizeof(struct app), GFP_KERNEL);
 
     if (!a) {
-        printk(KERN_ERR "xt_seng: OOM in add_app!");
+        pr_err_ratelimited("xt_seng: OOM in add_app!\n");
         return NULL;
     }
 
     memcpy(a->app_hash, app_hash, SGX_HASH_SIZE);
 
-    INIT_LIST_HEAD(&(a->categories));
+    bitmap_zero(a->categories, SENG_MAX_CATEGORIES);
     a->reference_counter = 1;
-    list_add(&(a->app_node), &apps);
 
-    #ifdef DEBUG_SENGMOD
-    printk(KERN_DEBUG "xt_seng: added app (%s)", a->app_hash);
-    #endif
+    err = rhashtable_insert_fast(&db->app_table, &a->hash_node, app_params);
+    if (err) {
+        pr_err_ratelimited("xt_seng: Failed to insert app (%d)!\n", err);
+        kfree(a);
+        return NULL;
+    }
+
+    list_add(&(a->app_node), &db->apps);
+
+    trace_seng_app_add(a->app_hash);
 
     return a;
 }
@@ -82,16 +205,14 @@ struct app* add_app (const uint8_t* app_hash) {
  *
  * Helps deleting all categories of a given app entry.
  *
+ * @param[in] db            the database of the app
  * @param[in] a             the app to be deleted in
  * */
-void del_cats_helper (struct app* a) {
-    struct list_head *pos, *q;
-    struct cat* c;
+void del_cats_helper (struct seng_metadb* db, struct app* a) {
+    unsigned int cat_id;
 
-    list_for_each_safe (pos, q, &(a->categories)) {
-        c = list_entry(pos, struct cat, cat_node);
-        list_del(&(c->cat_node));
-        kfree(c);
+    for_each_set_bit (cat_id, a->categories, SENG_MAX_CATEGORIES) {
+        del_cat_helper(db, a, cat_id);
     }
 }
 
@@ -100,17 +221,17 @@ void del_cats_helper (struct app* a) {
  *
  * Deletes an app entry if the reference counter is 1. Else the reference counter is decreased.
  *
- * @param[in] app_hash             the app hash to be added
+ * @param[in] db                   the database of the app
+ * @param[in] a                    the app to be deleted
  *
  * */
-void del_app (struct app* a) {
+void del_app (struct seng_metadb* db, struct app* a) {
     if (a->reference_counter == 1) {
-        del_cats_helper(a);
+        del_cats_helper(db, a);
+        rhashtable_remove_fast(&db->app_table, &a->hash_node, app_params);
         list_del(&(a->app_node));
-        #ifdef DEBUG_SENGMOD
-        printk(KERN_DEBUG "xt_seng: deleted app (%s)", a->app_hash);
-        #endif
-        kfree(a);
+        trace_seng_app_del(a->app_hash);
+        kfree_rcu(a, rcu);
     } else {
         a->reference_counter--;
     }
@@ -121,206 +242,645 @@ void del_app (struct app* a) {
  *
  * Deletes all apps from the apps list.
  *
+ * @param[in] db                   the database
  * */
-void del_all_apps (void) {
+void del_all_apps (struct seng_metadb* db) {
     struct list_head *pos, *q;
     struct app* a;
 
-    list_for_each_safe (pos, q, &apps) {
+    list_for_each_safe (pos, q, &db->apps) {
         a = list_entry(pos, struct app, app_node);
-        del_cats_helper(a);
+        del_cats_helper(db, a);
+        rhashtable_remove_fast(&db->app_table, &a->hash_node, app_params);
         list_del(&(a->app_node));
-        kfree(a);
+        kfree_rcu(a, rcu);
     }
 }
 
-/**
- * @brief hash function to determine key of enclaves
- *
- * Takes the last 8 bits of the ip as hash.
- *
- * @param[in] enclave_ip    The enclave ip to be hashed.
- *
- * @return the key
- * */
-uint8_t hash_func (uint32_t enclave_ip) {
-    return (uint8_t) (enclave_ip & 0xFF);
-}
-
-struct enclave* add_enclave (uint32_t pEnclave_ip, const uint8_t* app_hash, uint32_t host_ip) {
+struct enclave* add_enclave (struct seng_metadb* db, uint32_t pEnclave_ip, const uint8_t* app_hash, uint32_t host_ip) {
     struct enclave* e;
     struct app* a;
+    int err;
 
-    if (find_enclave(pEnclave_ip)) {
-        printk(KERN_ERR "xt_seng: Enclave duplicate.");
+    struct enclave_subnet* sn = writer_subnet(db);
+
+    if (rhashtable_lookup_fast(&db->enclaves, &pEnclave_ip, enclave_params)) {
+        pr_err_ratelimited("xt_seng: Enclave duplicate.\n");
+        return NULL;
+    }
+
+    if (sn && !in_subnet(sn, pEnclave_ip)) {
+        pr_err_ratelimited("xt_seng: Enclave outside of the enclave subnet.\n");
         return NULL;
     }
 
     e = kmalloc(sizeof(struct enclave), GFP_KERNEL);
+    if (!e) {
+        pr_err_ratelimited("xt_seng: OOM in add_enclave!\n");
+        return NULL;
+    }
+
     e->enclave_ip = pEnclave_ip;
-    e->enclave_key = hash_func(pEnclave_ip);
     e->host_ip = host_ip;
+    e->family = AF_INET;
 
-    a = add_app(app_hash);
+    a = add_app(db, app_hash);
+    if (!a) {
+        kfree(e);
+        return NULL;
+    }
 
     e->a = a;
 
-    hash_add(enclaves, &e->enclave_node, e->enclave_key);
+    // slot 0 marks unused references
+    err = idr_alloc(&db->enclave_idr, e, 1, 0, GFP_KERNEL);
+    if (err < 0) {
+        pr_err_ratelimited("xt_seng: Failed to allocate enclave slot (%d)!\n", err);
+        del_app(db, a);
+        kfree(e);
+        return NULL;
+    }
+    e->ct_slot = err;
+
+    // publishes the fully initialized enclave to the packet path
+    err = rhashtable_insert_fast(&db->enclaves, &e->enclave_node, enclave_params);
+    if (err) {
+        pr_err_ratelimited("xt_seng: Failed to insert enclave (%d)!\n", err);
+        idr_remove(&db->enclave_idr, e->ct_slot);
+        del_app(db, a);
+        kfree_rcu(e, rcu);
+        return NULL;
+    }
+
+    list_add(&e->list_node, &db->enclave_list);
+
+    if (sn) rcu_assign_pointer(sn->slots[subnet_idx(sn, pEnclave_ip)], e);
+
+    bump_seq(db);
 
     return e;
 
 }
 
-bool del_enclave (uint32_t pEnclave_ip) {
+bool del_enclave (struct seng_metadb* db, uint32_t pEnclave_ip) {
     struct enclave *e;
-    uint8_t pKey = hash_func(pEnclave_ip);
-
-    hash_for_each_possible(enclaves, e, enclave_node, pKey) {
-        if (e->enclave_ip == pEnclave_ip) {
-            del_app(e->a);
-            hash_del(&e->enclave_node);
-            kfree(e);
-            return true;
-        }
+    struct enclave_subnet* sn = writer_subnet(db);
+
+    e = rhashtable_lookup_fast(&db->enclaves, &pEnclave_ip, enclave_params);
+    if (!e) return false;
+
+    if (sn) RCU_INIT_POINTER(sn->slots[subnet_idx(sn, pEnclave_ip)], NULL);
+    rhashtable_remove_fast(&db->enclaves, &e->enclave_node, enclave_params);
+    idr_remove(&db->enclave_idr, e->ct_slot);
+    bump_seq(db);
+
+    list_del(&e->list_node);
+    del_app(db, e->a);
+    kfree_rcu(e, rcu);
+
+    return true;
+}
+
+struct enclave* add_enclave6 (struct seng_metadb* db, const struct in6_addr* enclave_ip, const uint8_t* app_hash, const struct in6_addr* host_ip) {
+    struct enclave* e;
+    struct app* a;
+    int err;
+
+    if (rhashtable_lookup_fast(&db->enclaves6, enclave_ip, enclave6_params)) {
+        pr_err_ratelimited("xt_seng: Enclave duplicate.\n");
+        return NULL;
     }
 
-    return false;
+    e = kzalloc(sizeof(struct enclave), GFP_KERNEL);
+    if (!e) {
+        pr_err_ratelimited("xt_seng: OOM in add_enclave6!\n");
+        return NULL;
+    }
+
+    e->enclave_ip6 = *enclave_ip;
+    e->host_ip6 = *host_ip;
+    e->family = AF_INET6;
+
+    a = add_app(db, app_hash);
+    if (!a) {
+        kfree(e);
+        return NULL;
+    }
+
+    e->a = a;
+
+    // slot 0 marks unused references
+    err = idr_alloc(&db->enclave_idr, e, 1, 0, GFP_KERNEL);
+    if (err < 0) {
+        pr_err_ratelimited("xt_seng: Failed to allocate enclave slot (%d)!\n", err);
+        del_app(db, a);
+        kfree(e);
+        return NULL;
+    }
+    e->ct_slot = err;
+
+    // publishes the fully initialized enclave to the packet path
+    err = rhashtable_insert_fast(&db->enclaves6, &e->enclave_node, enclave6_params);
+    if (err) {
+        pr_err_ratelimited("xt_seng: Failed to insert enclave (%d)!\n", err);
+        idr_remove(&db->enclave_idr, e->ct_slot);
+        del_app(db, a);
+        kfree_rcu(e, rcu);
+        return NULL;
+    }
+
+    list_add(&e->list_node, &db->enclave_list);
+
+    bump_seq(db);
+
+    return e;
 }
 
-struct enclave* find_enclave (uint32_t pEnclave_ip) {
+bool del_enclave6 (struct seng_metadb* db, const struct in6_addr* enclave_ip) {
     struct enclave *e;
-    uint8_t pKey = hash_func(pEnclave_ip);
 
-    hash_for_each_possible(enclaves, e, enclave_node, pKey) {
-        if (e->enclave_ip == pEnclave_ip) {
-            return e;
+    e = rhashtable_lookup_fast(&db->enclaves6, enclave_ip, enclave6_params);
+    if (!e) return false;
+
+    rhashtable_remove_fast(&db->enclaves6, &e->enclave_node, enclave6_params);
+    idr_remove(&db->enclave_idr, e->ct_slot);
+    bump_seq(db);
+
+    list_del(&e->list_node);
+    del_app(db, e->a);
+    kfree_rcu(e, rcu);
+
+    return true;
+}
+
+struct enclave* find_enclave6 (struct seng_metadb* db, const struct in6_addr* enclave_ip) {
+    return rhashtable_lookup(&db->enclaves6, enclave_ip, enclave6_params);
+}
+
+struct enclave* find_enclave (struct seng_metadb* db, uint32_t pEnclave_ip) {
+    struct enclave_subnet* sn = rcu_dereference(db->subnet);
+
+    // subnet mode: quick reject of foreign ips, else a single array load
+    if (sn) {
+        if (!in_subnet(sn, pEnclave_ip)) return NULL;
+        return rcu_dereference(sn->slots[subnet_idx(sn, pEnclave_ip)]);
+    }
+
+    return rhashtable_lookup(&db->enclaves, &pEnclave_ip, enclave_params);
+}
+
+struct enclave* find_enclave_by_slot (struct seng_metadb* db, uint32_t slot) {
+    if (!slot) return NULL;
+
+    return idr_find(&db->enclave_idr, slot);
+}
+
+struct enclave* next_enclave (struct seng_metadb* db, int* slot) {
+    return idr_get_next(&db->enclave_idr, slot);
+}
+
+void del_all_enclaves (struct seng_metadb* db) {
+    struct enclave *e, *tmp;
+    struct enclave_subnet* sn = writer_subnet(db);
+
+    list_for_each_entry (e, &db->enclave_list, list_node) {
+        if (e->family == AF_INET6) {
+            rhashtable_remove_fast(&db->enclaves6, &e->enclave_node, enclave6_params);
+        } else {
+            if (sn) RCU_INIT_POINTER(sn->slots[subnet_idx(sn, e->enclave_ip)], NULL);
+            rhashtable_remove_fast(&db->enclaves, &e->enclave_node, enclave_params);
         }
+        idr_remove(&db->enclave_idr, e->ct_slot);
+    }
+
+    bump_seq(db);
+
+    list_for_each_entry_safe (e, tmp, &db->enclave_list, list_node) {
+        list_del(&e->list_node);
+        kfree_rcu(e, rcu);
     }
 
-    return NULL;
+    del_all_apps(db);
+
 }
 
-void del_all_enclaves (void) {
-    struct enclave *e;
-    unsigned int bkt = 0;
+/**
+ * @brief allocates an empty database generation
+ *
+ * @param[in] sn        the database state of the owning namespace
+ *
+ * @return the database or NULL in case of out of memory
+ * */
+static struct seng_metadb* metadb_alloc (struct seng_net* sn) {
+    struct rhashtable_params params = enclave_params;
+    struct seng_metadb* db;
+
+    db = kzalloc(sizeof(*db), GFP_KERNEL);
+    if (!db) return NULL;
+
+    params.nelem_hint = enclave_table_size;
+
+    if (rhashtable_init(&db->enclaves, &params)) goto err_db;
+    if (rhashtable_init(&db->enclaves6, &enclave6_params)) goto err_enclaves;
+    if (rhashtable_init(&db->app_table, &app_params)) goto err_enclaves6;
+
+    INIT_LIST_HEAD(&db->enclave_list);
+    INIT_LIST_HEAD(&db->apps);
+    idr_init(&db->enclave_idr);
+    db->lock = &sn->mutex;
+    db->cats = &sn->cats;
+    db->gen = atomic64_inc_return(&metadb_gen);
+
+    return db;
+
+    err_enclaves6:
+        rhashtable_destroy(&db->enclaves6);
+    err_enclaves:
+        rhashtable_destroy(&db->enclaves);
+    err_db:
+        kfree(db);
+        return NULL;
+}
 
-    hash_for_each(enclaves, bkt, e, enclave_node) {
-        hash_del(&e->enclave_node);
-        kfree(e);
+/**
+ * @brief frees a database generation
+ *
+ * The packet path must not be able to reach the database anymore, i.e., it either has never been published
+ * or a grace period passed since it has been unpublished. Must be called with the namespace mutex held.
+ *
+ * @param[in] db        the database
+ * */
+static void metadb_free (struct seng_metadb* db) {
+    del_all_enclaves(db);
+
+    kvfree(writer_subnet(db));
+    rhashtable_destroy(&db->enclaves);
+    rhashtable_destroy(&db->enclaves6);
+    rhashtable_destroy(&db->app_table);
+    idr_destroy(&db->enclave_idr);
+    kfree(db);
+}
+
+/**
+ * @brief creates the database and policy map of a new network namespace
+ *
+ * @param[in] net       the network namespace
+ *
+ * @return 0 on success, else a negative error code
+ * */
+static int __net_init seng_net_init (struct net* net) {
+    struct seng_net* sn = seng_pernet(net);
+    struct seng_metadb* db;
+    int err;
+
+    mutex_init(&sn->mutex);
+    mutex_init(&sn->cats.mutex);
+    memset(sn->cats.table, 0, sizeof(sn->cats.table));
+    sn->shadow = NULL;
+
+    if ((err = seng_policy_init(&sn->policy, &sn->mutex, &sn->cats))) return err;
+
+    db = metadb_alloc(sn);
+    if (!db) {
+        seng_policy_destroy(&sn->policy);
+        return -ENOMEM;
     }
 
-    del_all_apps();
+    RCU_INIT_POINTER(sn->metadb, db);
+    return 0;
+}
 
+/**
+ * @brief frees the database and policy map of a dismantled network namespace
+ *
+ * @param[in] net       the network namespace
+ * */
+static void __net_exit seng_net_exit (struct net* net) {
+    struct seng_net* sn = seng_pernet(net);
+
+    mutex_lock(&sn->mutex);
+    // the namespace has no devices left, i.e., no readers and no grace period required
+    metadb_stage_abort(sn);
+    metadb_free(metadb_writer(sn));
+    RCU_INIT_POINTER(sn->metadb, NULL);
+    seng_policy_destroy(&sn->policy);
+    mutex_unlock(&sn->mutex);
 }
 
-bool add_cat_to_app (struct app* a, const char* category_name) {
-    struct cat* c;
-    struct cat* c_tmp;
-    struct list_head *pos, *q;
+/**
+ * @brief per-namespace operations of the database
+ * */
+static struct pernet_operations seng_net_ops = {
+    .init = seng_net_init,
+    .exit = seng_net_exit,
+    .id = &seng_net_id,
+    .size = sizeof(struct seng_net),
+};
+
+struct seng_net* seng_pernet (const struct net* net) {
+    return net_generic(net, seng_net_id);
+}
 
-    if (!category_name) {
-        printk(KERN_ERR "xt_seng: called add_cat with null pointer!");
-        return false;
+int metadb_init (void) {
+    return register_pernet_subsys(&seng_net_ops);
+}
+
+void metadb_exit (void) {
+    unregister_pernet_subsys(&seng_net_ops);
+}
+
+struct seng_metadb* metadb_staged (struct seng_net* sn) {
+    return sn->shadow;
+}
+
+int metadb_stage_begin (struct seng_net* sn) {
+    struct enclave_subnet* subnet = writer_subnet(metadb_writer(sn));
+    int err;
+
+    metadb_stage_abort(sn);
+
+    sn->shadow = metadb_alloc(sn);
+    if (!sn->shadow) {
+        pr_err_ratelimited("xt_seng: OOM in metadb_stage_begin!\n");
+        return -ENOMEM;
     }
 
-    list_for_each_safe (pos, q, &(a->categories)) {
-        c_tmp = list_entry(pos, struct cat, cat_node);
-        if (strncmp(category_name, c_tmp->category_name, MAX_CAT_NAME_LENGTH) == 0) {
-            printk(KERN_DEBUG "xt_seng: duplicate category (%s) in app (%s)", category_name, a->app_hash);
-            return true;
+    // the new generation inherits subnet mode
+    if (subnet) {
+        err = set_enclave_subnet(sn->shadow, subnet->base, 32 - ilog2(subnet->size));
+        if (err) {
+            metadb_stage_abort(sn);
+            return err;
         }
     }
 
-    c = kmalloc(sizeof(struct cat), GFP_KERNEL);
+    return 0;
+}
 
-    if (!c) {
-        printk(KERN_ERR "xt_seng: OOM in add_cat!");
-        return false;
+struct seng_metadb* metadb_stage_commit (struct seng_net* sn) {
+    struct seng_metadb* old = metadb_writer(sn);
+
+    if (!sn->shadow) {
+        pr_err_ratelimited("xt_seng: No staged database to be committed!\n");
+        return ERR_PTR(-ENOENT);
     }
 
-    strncpy(c->category_name, category_name, MAX_CAT_NAME_LENGTH - 1);
-    c->category_name[MAX_CAT_NAME_LENGTH - 1] = 0;
+    // continues the counter, so that interrupted dumps of the namespace are detected
+    WRITE_ONCE(sn->shadow->seq, old->seq + 1);
+    rcu_assign_pointer(sn->metadb, sn->shadow);
+    sn->shadow = NULL;
 
-    list_add(&(c->cat_node), &(a->categories));
+    // the packet path might still traverse the old generation
+    synchronize_rcu();
 
-    #ifdef DEBUG_SENGMOD
-    printk(KERN_DEBUG "xt_seng: added category (%s) in app (%s)", category_name, a->app_hash);
-    #endif
+    return old;
+}
 
-    return true;
+void metadb_retire (struct seng_metadb* db) {
+    metadb_free(db);
+}
+
+bool metadb_enclave_stale (struct seng_metadb* db, const struct enclave* e) {
+    const struct enclave* cur;
 
+    if (e->family == AF_INET6) {
+        cur = find_enclave6(db, &e->enclave_ip6);
+        return !cur || !match_app(cur->a, e->a->app_hash) || !ipv6_addr_equal(&cur->host_ip6, &e->host_ip6);
+    }
+
+    cur = find_enclave(db, e->enclave_ip);
+    return !cur || !match_app(cur->a, e->a->app_hash) || cur->host_ip != e->host_ip;
 }
 
-bool del_cat_from_app (struct app* a, const char* category_name) {
-    struct list_head *pos, *q;
-    struct cat* c;
+void metadb_stage_abort (struct seng_net* sn) {
+    if (!sn->shadow) return;
 
-    list_for_each_safe (pos, q, &(a->categories)) {
-        c = list_entry(pos, struct cat, cat_node);
-        if (strncmp(category_name, c->category_name, MAX_CAT_NAME_LENGTH) == 0) {
-            list_del(&(c->cat_node));
-            kfree(c);
-            #ifdef DEBUG_SENGMOD
-            printk(KERN_DEBUG "xt_seng: Deleted category (%s) from app (%s)", category_name, a->app_hash);
-            #endif
-            return true;
+    // never published, i.e., no grace period required
+    metadb_free(sn->shadow);
+    sn->shadow = NULL;
+}
+
+int set_enclave_subnet (struct seng_metadb* db, uint32_t base, uint32_t prefix_len) {
+    struct enclave_subnet *sn, *old;
+    struct enclave *e;
+    uint32_t size;
+
+    if (prefix_len < SENG_SUBNET_MIN_PREFIX || prefix_len > 32) {
+        pr_err_ratelimited("xt_seng: Invalid enclave subnet prefix length (%u)!\n", prefix_len);
+        return -EINVAL;
+    }
+
+    size = 1U << (32 - prefix_len);
+
+    sn = kvzalloc(sizeof(*sn) + size * sizeof(sn->slots[0]), GFP_KERNEL);
+    if (!sn) {
+        pr_err_ratelimited("xt_seng: OOM in set_enclave_subnet!\n");
+        return -ENOMEM;
+    }
+
+    sn->mask = htonl(~(size - 1));
+    sn->base = base;
+    sn->size = size;
+
+    if ((base & sn->mask) != base) {
+        pr_err_ratelimited("xt_seng: Enclave subnet base is not aligned to the prefix length!\n");
+        kvfree(sn);
+        return -EINVAL;
+    }
+
+    // all existing ipv4 enclaves must be covered, as the table is no longer consulted
+    list_for_each_entry (e, &db->enclave_list, list_node) {
+        if (e->family != AF_INET) continue;
+        if (!in_subnet(sn, e->enclave_ip)) {
+            pr_err_ratelimited("xt_seng: Existing enclave outside of the new enclave subnet!\n");
+            kvfree(sn);
+            return -EINVAL;
         }
+        RCU_INIT_POINTER(sn->slots[subnet_idx(sn, e->enclave_ip)], e);
     }
 
-    printk(KERN_DEBUG "xt_seng: not found in del_cat from app");
-    return false;
+    old = writer_subnet(db);
+    rcu_assign_pointer(db->subnet, sn);
+    if (old) call_rcu(&old->rcu, free_subnet_rcu);
 
+    return 0;
 }
 
-bool del_cat (const char* category_name) {
+void clear_enclave_subnet (struct seng_metadb* db) {
+    struct enclave_subnet *old = writer_subnet(db);
 
-    struct app* a;
-    struct list_head *pos, *q;
+    if (!old) return;
 
-    list_for_each_safe (pos, q, &apps) {
-        a = list_entry(pos, struct app, app_node);
-        del_cat_helper(a, category_name);
-    }
+    // readers fall back to the hash table, which always contains all enclaves
+    RCU_INIT_POINTER(db->subnet, NULL);
+    call_rcu(&old->rcu, free_subnet_rcu);
+}
 
-    return false;
+/**
+ * @brief tries to find the id of a category name
+ *
+ * Must be called with the mutex of the category table held.
+ *
+ * @param[in] cats           the category table
+ * @param[in] cat_name       the category name
+ *
+ * @return the category id, else -ENOENT
+ * */
+static int __find_cat_id (struct seng_cats* cats, const char* cat_name) {
+    int i;
+
+    for (i = 0; i < SENG_MAX_CATEGORIES; i++) {
+        if (cats->table[i] && strncmp(cats->table[i]->category_name, cat_name, MAX_CAT_NAME_LENGTH) == 0) {
+            return i;
+        }
+    }
 
+    return -ENOENT;
 }
 
-struct cat* find_cat (struct app* a, const char* cat_name) {
+int find_cat_id (struct seng_cats* cats, const char* cat_name) {
+    int id;
 
+    mutex_lock(&cats->mutex);
+    id = __find_cat_id(cats, cat_name);
+    mutex_unlock(&cats->mutex);
+
+    return id;
+}
+
+int intern_cat (struct seng_cats* cats, const char* cat_name) {
     struct cat* c;
+    int id, free_id = -1;
 
-    list_for_each_entry (c, &(a->categories), cat_node) {
-        if (strncmp(c->category_name, cat_name, MAX_CAT_NAME_LENGTH) == 0) {
-            return c;
+    if (!cat_name) {
+        pr_err_ratelimited("xt_seng: called intern_cat with null pointer!\n");
+        return -EINVAL;
+    }
+
+    mutex_lock(&cats->mutex);
+
+    id = __find_cat_id(cats, cat_name);
+    if (id >= 0) {
+        cats->table[id]->reference_counter++;
+        goto out;
+    }
+
+    for (id = 0; id < SENG_MAX_CATEGORIES; id++) {
+        if (!cats->table[id]) {
+            free_id = id;
+            break;
         }
     }
 
-    printk(KERN_DEBUG "xt_seng: Could not find category %s in app %s", cat_name, a->app_hash);
+    if (free_id < 0) {
+        pr_err_ratelimited("xt_seng: Category table full, cannot add (%s)!\n", cat_name);
+        id = -ENOSPC;
+        goto out;
+    }
 
-    return NULL;
+    c = kmalloc(sizeof(struct cat), GFP_KERNEL);
+
+    if (!c) {
+        pr_err_ratelimited("xt_seng: OOM in intern_cat!\n");
+        id = -ENOMEM;
+        goto out;
+    }
 
+    strncpy(c->category_name, cat_name, MAX_CAT_NAME_LENGTH - 1);
+    c->category_name[MAX_CAT_NAME_LENGTH - 1] = 0;
+    c->id = free_id;
+    c->reference_counter = 1;
+
+    WRITE_ONCE(cats->table[free_id], c);
+
+    trace_seng_cat_intern(c->category_name, free_id);
+
+    id = free_id;
+
+    out:
+        mutex_unlock(&cats->mutex);
+        return id;
 }
 
-struct app* lookup_app_hash (const uint8_t* app_hash) {
-    struct app* a;
+const char* get_cat_name (struct seng_cats* cats, uint16_t cat_id) {
+    // referenced categories are never freed or moved
+    struct cat* c = READ_ONCE(cats->table[cat_id]);
 
-    list_for_each_entry (a, &apps, app_node) {
-        if (memcmp(a->app_hash, app_hash, SGX_HASH_SIZE) == 0) {
-            return a;
-        }
+    return c ? c->category_name : NULL;
+}
+
+void put_cat (struct seng_cats* cats, uint16_t cat_id) {
+    struct cat* c;
+
+    mutex_lock(&cats->mutex);
+
+    c = cats->table[cat_id];
+    if (WARN_ON(!c)) goto out;
+
+    if (--c->reference_counter == 0) {
+        WRITE_ONCE(cats->table[cat_id], NULL);
+        kfree(c);
     }
 
-    return NULL;
+    out:
+        mutex_unlock(&cats->mutex);
+}
+
+bool add_cat_to_app (struct seng_metadb* db, struct app* a, const char* category_name) {
+    int cat_id;
+
+    if (!category_name) {
+        pr_err_ratelimited("xt_seng: called add_cat with null pointer!\n");
+        return false;
+    }
+
+    cat_id = find_cat_id(db->cats, category_name);
+    if (cat_id >= 0 && test_bit(cat_id, a->categories)) {
+        trace_seng_cat_add(a->app_hash, category_name, -EEXIST);
+        return true;
+    }
+
+    // the app holds a reference to the category as long as its bit is set
+    cat_id = intern_cat(db->cats, category_name);
+    trace_seng_cat_add(a->app_hash, category_name, cat_id < 0 ? cat_id : 0);
+    if (cat_id < 0) return false;
+
+    set_bit(cat_id, a->categories);
+
+    return true;
+
 }
 
-bool match_app(struct app* a, const uint8_t* rule_app_hash) {
-    if (memcmp(&a->app_hash, rule_app_hash, SGX_HASH_SIZE) == 0) return true;
+bool del_cat_from_app (struct seng_metadb* db, struct app* a, const char* category_name) {
+    int cat_id = find_cat_id(db->cats, category_name);
+
+    if (cat_id >= 0 && del_cat_helper(db, a, cat_id)) {
+        trace_seng_cat_del(a->app_hash, category_name, 0);
+        return true;
+    }
+
+    trace_seng_cat_del(a->app_hash, category_name, -ENOENT);
     return false;
+
 }
 
-bool match_category(struct app* a, const char* rule_cat_name) {
-    struct cat* c = find_cat(a, rule_cat_name);
-    if (c) return true;
+bool del_cat (struct seng_metadb* db, const char* category_name) {
+
+    struct app* a;
+    struct list_head *pos, *q;
+    int cat_id = find_cat_id(db->cats, category_name);
+
+    if (cat_id < 0) return false;
+
+    list_for_each_safe (pos, q, &db->apps) {
+        a = list_entry(pos, struct app, app_node);
+        del_cat_helper(db, a, cat_id);
+    }
+
     return false;
+
+}
+
+struct app* lookup_app_hash (struct seng_metadb* db, const uint8_t* app_hash) {
+    return rhashtable_lookup_fast(&db->app_table, app_hash, app_params);
 }
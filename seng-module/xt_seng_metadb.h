@@ -1,146 +1,505 @@
 #ifndef SENG_XT_SENG_METADB_H
 #define SENG_XT_SENG_METADB_H
 
-#include <linux/hashtable.h>
+#include <linux/rhashtable.h>
 #include <linux/list.h>
+#include <linux/bitmap.h>
+#include <linux/string.h>
+#include <linux/mutex.h>
+#include <linux/rcupdate.h>
+#include <linux/idr.h>
+#include <linux/in6.h>
+#include <net/net_namespace.h>
+#include <asm/unaligned.h>
+
+#include "xt_seng_genl.h"
+#include "xt_seng_policy.h"
 
 /**
  * @brief stores one enclave
  *
  * Stores one enclave with additional content to be used in hash table.
+ * IPv4 enclaves are kept in the enclaves hash table, IPv6 enclaves in the enclaves6 hash table.
+ * The fields used by the IPv4 packet path come first.
  * */
 struct enclave {
-    uint32_t enclave_ip;            ///< the enclave ip = enclave identifier
-    uint8_t enclave_key;            ///< the enclave hash
+    uint32_t enclave_ip;            ///< the enclave ip = enclave identifier (AF_INET)
     struct app* a;                  ///< the app associated with the enclave
-    uint32_t host_ip;               ///< the host_ip associated with the enclave
-    struct hlist_node enclave_node; ///< hash table node
+    uint32_t host_ip;               ///< the host_ip associated with the enclave (AF_INET)
+    uint32_t ct_slot;               ///< slot number of the enclave (see find_enclave_by_slot())
+    uint8_t family;                 ///< address family of the enclave (AF_INET or AF_INET6)
+    struct rhash_head enclave_node; ///< hash table node
+    struct list_head list_node;     ///< linked list node (writer only)
+    struct rcu_head rcu;            ///< used for deferred freeing
+    struct in6_addr enclave_ip6;    ///< the enclave ip = enclave identifier (AF_INET6)
+    struct in6_addr host_ip6;       ///< the host ip associated with the enclave (AF_INET6, v4-mapped for ipv4 hosts)
 };
 
 /**
- * @brief stores one category
+ * @brief stores one interned category
  *
- * Stores one category to be used in a linked list.
+ * Stores one category of the category table of a network namespace.
+ * Referenced by all apps which have the category and by all rules which match on it.
  * */
 struct cat {
     char category_name[MAX_CAT_NAME_LENGTH]; ///< category name
-    struct list_head cat_node;               ///< linked list node
+    uint16_t id;                             ///< interned category id
+    uint32_t reference_counter;              ///< a reference counter to this category
 };
 
 /**
  * @brief stores one app
  *
- * Stores one app to be used in a linked list.
+ * Stores one app to be used in the apps hash table.
  * */
 struct app {
-    uint32_t reference_counter;    ///< a reference counter to this app_id
     uint8_t app_hash[SGX_HASH_SIZE]; ///< app hash
-    struct list_head categories;   ///< linked list containing associated categories
-    struct list_head app_node;     ///< linked list node
+    DECLARE_BITMAP(categories, SENG_MAX_CATEGORIES); ///< bitmap of the interned ids of associated categories
+    uint32_t reference_counter;    ///< a reference counter to this app_id (writer only)
+    struct rhash_head hash_node;   ///< hash table node (writer only)
+    struct list_head app_node;     ///< linked list node (writer only)
+    struct rcu_head rcu;           ///< used for deferred freeing
+};
+
+/**
+ * @brief direct-indexed enclave subnet
+ *
+ * Used in subnet mode, in which all enclaves are part of a single subnet.
+ * The host part of an enclave ip directly indexes the slots array,
+ * so that lookups become a bounds check plus a single array load.
+ * */
+struct enclave_subnet {
+    uint32_t base;                      ///< subnet base address (network byte order)
+    uint32_t mask;                      ///< subnet mask (network byte order)
+    uint32_t size;                      ///< amount of slots
+    struct rcu_head rcu;                ///< used for deferred freeing
+    struct enclave __rcu *slots[];      ///< enclaves indexed by the host part of their ip
 };
 
+/**
+ * @brief one generation of the database
+ *
+ * Contains all enclaves and apps of a network namespace. The packet path reads the active generation
+ * (seng_net.metadb) under RCU. A full resync builds a new generation in the background (metadb_stage_begin())
+ * and publishes it with a single pointer swap (metadb_stage_commit()), so that the packet path never sees
+ * a partial database. The category table is shared by all generations and namespaces.
+ * */
+struct seng_metadb {
+    struct rhashtable enclaves;             ///< enclaves keyed by their ip (jhash), automatically resized
+    struct rhashtable enclaves6;            ///< ipv6 enclaves keyed by their ip (jhash2), automatically resized
+    struct rhashtable app_table;            ///< apps keyed by their app hash (writer only)
+    struct list_head enclave_list;          ///< list of all enclaves (writer only)
+    struct list_head apps;                  ///< list of all apps (writer only)
+    struct idr enclave_idr;                 ///< slot numbers of the enclaves (see find_enclave_by_slot()), 0 is never used
+    struct enclave_subnet __rcu *subnet;    ///< direct-indexed enclave subnet, NULL if subnet mode is disabled
+    struct mutex* lock;                     ///< writer lock of the owning namespace (see seng_net)
+    struct seng_cats* cats;                 ///< category table of the owning namespace
+    u64 gen;                                ///< unique id of the generation, never reused
+    unsigned int seq;                       ///< sequence counter, see metadb_read_seq()
+};
+
+/**
+ * @brief the category table of a network namespace
+ *
+ * Interns category names into small integer ids (= index into the table).
+ * Apps store their categories as a bitmap of these ids and rules resolve their category names at insertion.
+ * Shared by all database generations of the namespace, so that every namespace has all SENG_MAX_CATEGORIES ids.
+ * Only used by the writers. Outlives the databases of a dismantled namespace until its rules released their categories.
+ * */
+struct seng_cats {
+    struct cat* table[SENG_MAX_CATEGORIES]; ///< interned categories indexed by their id
+    struct mutex mutex;                     ///< serializes all users of the table, nests inside the namespace mutex
+};
+
+/**
+ * @brief the database state of a network namespace
+ *
+ * Every network namespace has its own independent database, so that isolated gateways (e.g., containers)
+ * share one kernel without sharing or contending for a database.
+ * */
+struct seng_net {
+    struct mutex mutex;                     ///< serializes all writers of the namespace, never taken by the packet path
+    struct seng_metadb __rcu *metadb;       ///< the active generation, read by the packet path via rcu_dereference()
+    struct seng_metadb *shadow;             ///< the staged generation (never seen by the packet path), NULL if none
+    struct seng_policy policy;              ///< the policy map of the SENGMAP target
+    struct seng_cats cats;                  ///< the category table of the apps, rules and policy map
+};
+
+/**
+ * @brief registers the per-namespace databases
+ *
+ * Creates an empty database in every (current and future) network namespace.
+ *
+ * @return 0 on success, else a negative error code
+ * */
+int metadb_init (void);
+
+/**
+ * @brief unregisters the per-namespace databases
+ *
+ * Frees the databases of all network namespaces. The packet path must not be able to reach them anymore.
+ * Wait for the deferred frees (rcu_barrier()) before unloading.
+ * */
+void metadb_exit (void);
+
+/**
+ * @brief returns the database state of a network namespace
+ *
+ * @param[in] net       the network namespace
+ *
+ * @return the database state
+ * */
+struct seng_net* seng_pernet (const struct net* net);
+
+/**
+ * @brief returns the active database generation on the writer side
+ *
+ * All functions of this header that modify a database (add_*, del_*, set_*, clear_*, metadb_stage_*)
+ * as well as lookup_app_hash() and next_enclave() must be called with the mutex of its namespace held.
+ *
+ * @param[in] sn        the database state of the namespace
+ *
+ * @return the active database
+ * */
+static inline struct seng_metadb* metadb_writer (struct seng_net* sn) {
+    return rcu_dereference_protected(sn->metadb, lockdep_is_held(&sn->mutex));
+}
+
+/**
+ * @brief reads the sequence counter of a database
+ *
+ * The counter is advanced by the writers whenever enclaves are added or removed, before removed enclaves are freed.
+ * A committed generation continues the counter of the replaced one.
+ * Lookup results cached by readers are valid as long as the generation (seng_metadb.gen) and the counter did not change.
+ * Must be called before the lookups whose results are associated with the returned value.
+ *
+ * @param[in] db        the database
+ *
+ * @return the current sequence counter
+ * */
+static inline unsigned int metadb_read_seq (const struct seng_metadb* db) {
+    unsigned int seq = READ_ONCE(db->seq);
+    // pairs with smp_wmb() of the writers
+    smp_rmb();
+    return seq;
+}
+
+/**
+ * @brief begins a new staged database generation
+ *
+ * Allocates an empty generation, which the writers fill via metadb_staged() while the packet path keeps using
+ * the active one. Subnet mode is inherited from the active generation. Discards a previously staged generation.
+ *
+ * @param[in] sn        the database state of the namespace
+ *
+ * @return 0 on success, else a negative error code
+ * */
+int metadb_stage_begin (struct seng_net* sn);
+
+/**
+ * @brief returns the staged database generation
+ *
+ * @param[in] sn        the database state of the namespace
+ *
+ * @return the staged database or NULL if no generation is staged
+ * */
+struct seng_metadb* metadb_staged (struct seng_net* sn);
+
+/**
+ * @brief publishes the staged database generation
+ *
+ * Swaps the staged generation in with a single RCU pointer publish and waits for a grace period (blocks until then),
+ * i.e., the packet path uses the new generation only. The caller frees the returned old generation with metadb_retire().
+ *
+ * @param[in] sn        the database state of the namespace
+ *
+ * @return the old generation, or ERR_PTR(-ENOENT) if no generation is staged
+ * */
+struct seng_metadb* metadb_stage_commit (struct seng_net* sn);
+
+/**
+ * @brief frees a generation replaced by metadb_stage_commit()
+ *
+ * Must be called with the namespace mutex held.
+ *
+ * @param[in] db        the old generation
+ * */
+void metadb_retire (struct seng_metadb* db);
+
+/**
+ * @brief checks if an enclave has become stale in another generation
+ *
+ * An enclave is stale if the generation lacks its ip or associates the ip with another app or host,
+ * i.e., if the conntrack entries of the enclave must not be used anymore.
+ * Must be called inside an RCU read-side critical section.
+ *
+ * @param[in] db        the other generation
+ * @param[in] e         the enclave
+ *
+ * @return true if the enclave is stale, else false
+ * */
+bool metadb_enclave_stale (struct seng_metadb* db, const struct enclave* e);
+
+/**
+ * @brief discards the staged database generation (if any)
+ *
+ * @param[in] sn        the database state of the namespace
+ * */
+void metadb_stage_abort (struct seng_net* sn);
+
 /**
  * @brief adds an enclave into the hash table
  *
  * Adds an enclave into the enclaves hash table.
- * The app_hash is looked up in the apps list, and a pointer to an existing app is set if possible.
+ * The app_hash is looked up in the apps hash table, and a pointer to an existing app is set if possible.
  * Else the app is newly added to the list and the pointer is set.
  *
+ * @param[in] db                the database
  * @param[in] pEnclave_ip       the enclave identifier
  * @param[in] app_hash          the app_hash associated with the enclave
  * @param[in] host_ip           the host_ip associated with the enclave
  *
  * @return the pointer to the added enclave
  * */
-struct enclave* add_enclave (uint32_t pEnclave_ip, const uint8_t* app_hash, uint32_t host_ip);
+struct enclave* add_enclave (struct seng_metadb* db, uint32_t pEnclave_ip, const uint8_t* app_hash, uint32_t host_ip);
 
 /**
  * @brief looks up an enclave in the hash table
  *
  * Tries to find an enclave in the enclaves hash table.
+ * In subnet mode, ips outside of the enclave subnet are rejected without hashing,
+ * all others are resolved by a single array access.
+ * Must be called inside an RCU read-side critical section or with the namespace mutex held.
+ * The returned enclave (and its app) stays valid until the end of the critical section.
  *
+ * @param[in] db                the database (e.g., rcu_dereference(sn->metadb))
  * @param[in] pEnclave_ip       the enclave identifier
  *
  * @return the pointer to the enclave, or NULL if not found
  * */
-struct enclave* find_enclave (uint32_t pEnclave_ip);
+struct enclave* find_enclave (struct seng_metadb* db, uint32_t pEnclave_ip);
+
+/**
+ * @brief adds an ipv6 enclave into the hash table
+ *
+ * Same as add_enclave(), but for an ipv6 enclave. Subnet mode only covers ipv4 enclaves.
+ *
+ * @param[in] db                the database
+ * @param[in] enclave_ip        the enclave identifier
+ * @param[in] app_hash          the app_hash associated with the enclave
+ * @param[in] host_ip           the host_ip associated with the enclave (v4-mapped for ipv4 hosts)
+ *
+ * @return the pointer to the added enclave
+ * */
+struct enclave* add_enclave6 (struct seng_metadb* db, const struct in6_addr* enclave_ip, const uint8_t* app_hash, const struct in6_addr* host_ip);
+
+/**
+ * @brief looks up an ipv6 enclave in the hash table
+ *
+ * Same as find_enclave(), but for an ipv6 enclave.
+ *
+ * @param[in] db                the database
+ * @param[in] enclave_ip        the enclave identifier
+ *
+ * @return the pointer to the enclave, or NULL if not found
+ * */
+struct enclave* find_enclave6 (struct seng_metadb* db, const struct in6_addr* enclave_ip);
+
+/**
+ * @brief looks up an enclave by its slot number
+ *
+ * Re-resolves an enclave reference (slot number) that has been stored outside of the database,
+ * e.g., in a conntrack entry. Slots of removed enclaves are reused, i.e., the reference is only
+ * valid if the address of the returned enclave is the one it was stored for.
+ * As enclave addresses are unique, such an enclave is the current one of the address.
+ * Must be called inside an RCU read-side critical section.
+ *
+ * @param[in] db            the database
+ * @param[in] slot          the slot number of the enclave
+ *
+ * @return the pointer to the enclave in the slot, or NULL if the slot is unused
+ * */
+struct enclave* find_enclave_by_slot (struct seng_metadb* db, uint32_t slot);
+
+/**
+ * @brief iterates over the enclaves of a database in slot order
+ *
+ * Returns the enclave with the lowest slot number greater or equal to *slot.
+ * The slot number is a stable cursor, i.e., iterations can be resumed after dropping the namespace mutex.
+ *
+ * @param[in] db            the database
+ * @param[in,out] slot      the first slot to be considered, set to the slot of the returned enclave
+ *
+ * @return the pointer to the enclave, or NULL if there are no more enclaves
+ * */
+struct enclave* next_enclave (struct seng_metadb* db, int* slot);
 
 /**
  * @brief deletes an enclave in the hash table
  *
  * Deletes the given enclave.
  *
+ * @param[in] db               the database
+ * @param[in] enclave_ip       the enclave identifier
+ *
+ * @return true on success, else false
+ * */
+bool del_enclave (struct seng_metadb* db, uint32_t enclave_ip);
+
+/**
+ * @brief deletes an ipv6 enclave in the hash table
+ *
+ * @param[in] db               the database
  * @param[in] enclave_ip       the enclave identifier
  *
  * @return true on success, else false
  * */
-bool del_enclave (uint32_t enclave_ip);
+bool del_enclave6 (struct seng_metadb* db, const struct in6_addr* enclave_ip);
+
+/**
+ * @brief enables subnet mode
+ *
+ * Switches the lookups to a direct-indexed array covering the given enclave subnet (or replaces the previous one).
+ * Fails if an existing enclave is outside of the subnet. Afterwards, enclaves outside of the subnet are rejected.
+ *
+ * @param[in] db            the database
+ * @param[in] base          the subnet base address (network byte order)
+ * @param[in] prefix_len    the subnet prefix length (SENG_SUBNET_MIN_PREFIX to 32)
+ *
+ * @return 0 on success, else a negative error code
+ * */
+int set_enclave_subnet (struct seng_metadb* db, uint32_t base, uint32_t prefix_len);
+
+/**
+ * @brief disables subnet mode
+ *
+ * Switches the lookups back to the enclaves hash table.
+ *
+ * @param[in] db            the database
+ * */
+void clear_enclave_subnet (struct seng_metadb* db);
 
 /**
  * @brief deletes all enclaves in the hash table
  *
- * Deletes all enclaves in the enclaves hash table and all apps in the apps list.
+ * Deletes all enclaves in the enclaves hash table and all apps in the apps hash table.
  *
+ * @param[in] db            the database
  * */
-void del_all_enclaves (void);
+void del_all_enclaves (struct seng_metadb* db);
 
 /**
  * @brief adds a given category to the given app
  *
  * Adds a given category to the given app.
  *
+ * @param[in] db             the database of the app
  * @param[in] a              the app to be added to
  * @param[in] cat_name       the category to be added
  *
  * @return true on success, else false
  * */
-bool add_cat_to_app (struct app* a, const char* cat_name);
+bool add_cat_to_app (struct seng_metadb* db, struct app* a, const char* cat_name);
 
 /**
  * @brief deletes a given category from the given app
  *
  * Deletes a given category from the given app.
  *
+ * @param[in] db             the database of the app
  * @param[in] a              the app to be deleted from
  * @param[in] cat_name       the category to be deleted
  *
  * @return true on success, else false
  * */
-bool del_cat_from_app (struct app* a, const char* cat_name);
+bool del_cat_from_app (struct seng_metadb* db, struct app* a, const char* cat_name);
 
 /**
  * @brief deletes all entries in apps given the category name
  *
  * Deletes all entries in apps given the category name.
  *
+ * @param[in] db             the database
  * @param[in] cat_name       the category to be deleted
  *
  * @return true on success, else false
  * */
-bool del_cat (const char* cat_name);
+bool del_cat (struct seng_metadb* db, const char* cat_name);
 
 /**
- * @brief tries to find a category in the given app
+ * @brief interns a category name
  *
- * Tries to find a category in the given app.
+ * Looks up the category name in the category table of the namespace or adds it, and takes a reference to it.
+ * The category table has its own lock, i.e., it may be called without holding a namespace mutex.
  *
- * @param[in] a              the app to be searched in
- * @param[in] cat_name       the category to be searched
+ * @param[in] cats           the category table
+ * @param[in] cat_name       the category name
  *
- * @return a pointer to the category, else null
+ * @return the category id, or a negative error code (e.g., -ENOSPC if SENG_MAX_CATEGORIES is reached)
  * */
-struct cat* find_cat (struct app* a, const char* cat_name);
+int intern_cat (struct seng_cats* cats, const char* cat_name);
+
+/**
+ * @brief releases a reference to an interned category
+ *
+ * Frees the category id once the last app or rule released it.
+ *
+ * @param[in] cats           the category table
+ * @param[in] cat_id         the category id
+ * */
+void put_cat (struct seng_cats* cats, uint16_t cat_id);
+
+/**
+ * @brief tries to find the id of a category name
+ *
+ * Tries to find the category in the category table of the namespace. Does not take a reference.
+ *
+ * @param[in] cats           the category table
+ * @param[in] cat_name       the category name
+ *
+ * @return the category id, else -ENOENT
+ * */
+int find_cat_id (struct seng_cats* cats, const char* cat_name);
+
+/**
+ * @brief returns the name of an interned category
+ *
+ * The caller must hold a reference to the category (e.g., via an app of a locked database).
+ *
+ * @param[in] cats           the category table
+ * @param[in] cat_id         the category id
+ *
+ * @return the category name, or NULL if the id is unused
+ * */
+const char* get_cat_name (struct seng_cats* cats, uint16_t cat_id);
 
 /**
  * @brief tries to find an app matching the app hash
  *
- * Tries to find an app in the apps list, matching the given app hash.
+ * Tries to find an app in the apps hash table, matching the given app hash.
  *
+ * @param[in] db             the database
  * @param[in] app_hash       the app hash to be searched
  *
  * @return a pointer to the app, else null
  * */
-struct app* lookup_app_hash (const uint8_t* app_hash);
+struct app* lookup_app_hash (struct seng_metadb* db, const uint8_t* app_hash);
+
+/**
+ * @brief the hash function of hash tables keyed by app hashes
+ *
+ * The app hash (measurement) is a uniformly distributed digest, so its first word already is a good hash.
+ * Used by the apps of the database and the app entries of the policy map.
+ *
+ * @param[in] data      the app hash
+ * @param[in] len       length of the app hash (unused)
+ * @param[in] seed      seed of the hash table
+ *
+ * @return the hash
+ * */
+static inline u32 seng_app_hashfn (const void* data, u32 len, u32 seed) {
+    return get_unaligned((const u32*) data) ^ seed;
+}
 
 /**
  * @brief compares the given app hash with the one of the given app
@@ -152,17 +511,21 @@ struct app* lookup_app_hash (const uint8_t* app_hash);
  *
  * @return true on match, else false
  * */
-bool match_app(struct app* a, const uint8_t* rule_app_hash);
+static inline bool match_app(const struct app* a, const uint8_t* rule_app_hash) {
+    return memcmp(a->app_hash, rule_app_hash, SGX_HASH_SIZE) == 0;
+}
 
 /**
- * @brief tries to find the given category name in the given app
+ * @brief checks if the given app has the given category
  *
- * Tries to find the given category name in the given app.
+ * Checks the category bit of the app, i.e., a single bit test.
  *
- * @param[in] a                   the app to be searched in
- * @param[in] rule_cat_name       the category name to be looked up
+ * @param[in] a                   the app to be checked
+ * @param[in] rule_cat_id         the interned category id of the rule
  *
- * @return true on success, else false
+ * @return true if the app has the category, else false
  * */
-bool match_category(struct app* a, const char* rule_cat_name);
+static inline bool match_category(const struct app* a, uint16_t rule_cat_id) {
+    return test_bit(rule_cat_id, a->categories);
+}
 #endif
\ No newline at end of file
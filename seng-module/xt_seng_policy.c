@@ -0,0 +1,174 @@
+#include <linux/kernel.h>
+#include <linux/module.h>
+
+#include <linux/slab.h> //kmalloc
+#include <linux/string.h>
+
+#include "xt_seng.h"
+#include "xt_seng_metadb.h"
+#include "xt_seng_policy.h"
+
+/**
+ * @brief parameters of the app entries hash table
+ * */
+static const struct rhashtable_params policy_params = {
+    .key_len = SGX_HASH_SIZE,
+    .key_offset = offsetof(struct seng_policy_entry, app_hash),
+    .head_offset = offsetof(struct seng_policy_entry, node),
+    .hashfn = seng_app_hashfn,
+    .automatic_shrinking = true,
+};
+
+/**
+ * @brief returns a category entry on the writer side
+ *
+ * @param[in] p         the policy map
+ * @param[in] cat_id    the interned category id
+ *
+ * @return the entry, or NULL if the category has none
+ * */
+static struct seng_policy_entry* writer_cat_entry (struct seng_policy* p, uint16_t cat_id) {
+    return rcu_dereference_protected(p->cats[cat_id], lockdep_is_held(p->lock));
+}
+
+/**
+ * @brief unpublishes and frees an entry
+ *
+ * The entry is freed after a grace period, and category entries release their category.
+ *
+ * @param[in] p         the policy map
+ * @param[in] pe        the entry
+ * */
+static void unlink_entry (struct seng_policy* p, struct seng_policy_entry* pe) {
+    if (pe->is_cat) {
+        RCU_INIT_POINTER(p->cats[pe->cat_id], NULL);
+        WRITE_ONCE(p->n_cats, p->n_cats - 1);
+        put_cat(p->cat_table, pe->cat_id);
+    } else {
+        rhashtable_remove_fast(&p->apps, &pe->node, policy_params);
+    }
+
+    list_del(&pe->list_node);
+    kfree_rcu(pe, rcu);
+}
+
+int seng_policy_init (struct seng_policy* p, struct mutex* lock, struct seng_cats* cats) {
+    memset(p->cats, 0, sizeof(p->cats));
+    p->n_cats = 0;
+    p->lock = lock;
+    p->cat_table = cats;
+    INIT_LIST_HEAD(&p->entries);
+
+    return rhashtable_init(&p->apps, &policy_params);
+}
+
+void seng_policy_destroy (struct seng_policy* p) {
+    seng_policy_flush(p);
+    rhashtable_destroy(&p->apps);
+}
+
+int seng_policy_set (struct seng_policy* p, const uint8_t* app_hash, const char* cat_name, uint8_t verdict, const uint32_t* mark) {
+    struct seng_policy_entry *pe, *old;
+    int cat_id, err;
+
+    if (!app_hash == !cat_name || verdict >= __SENG_POLICY_MAX) return -EINVAL;
+
+    pe = kzalloc(sizeof(*pe), GFP_KERNEL);
+    if (!pe) return -ENOMEM;
+
+    pe->verdict = verdict;
+    if (mark) {
+        pe->has_mark = true;
+        pe->mark = *mark;
+    }
+
+    if (cat_name) {
+        if ((cat_id = intern_cat(p->cat_table, cat_name)) < 0) {
+            kfree(pe);
+            return cat_id;
+        }
+
+        pe->is_cat = true;
+        pe->cat_id = cat_id;
+
+        old = writer_cat_entry(p, cat_id);
+        rcu_assign_pointer(p->cats[cat_id], pe);
+        list_add(&pe->list_node, &p->entries);
+
+        if (old) {
+            // the new entry holds its own reference to the category
+            list_del(&old->list_node);
+            put_cat(p->cat_table, cat_id);
+            kfree_rcu(old, rcu);
+        } else {
+            WRITE_ONCE(p->n_cats, p->n_cats + 1);
+        }
+        return 0;
+    }
+
+    memcpy(pe->app_hash, app_hash, SGX_HASH_SIZE);
+
+    old = rhashtable_lookup_fast(&p->apps, app_hash, policy_params);
+    if (old) {
+        err = rhashtable_replace_fast(&p->apps, &old->node, &pe->node, policy_params);
+        if (!err) {
+            list_del(&old->list_node);
+            kfree_rcu(old, rcu);
+        }
+    } else {
+        err = rhashtable_insert_fast(&p->apps, &pe->node, policy_params);
+    }
+
+    if (err) {
+        kfree(pe);
+        return err;
+    }
+
+    list_add(&pe->list_node, &p->entries);
+    return 0;
+}
+
+bool seng_policy_del (struct seng_policy* p, const uint8_t* app_hash, const char* cat_name) {
+    struct seng_policy_entry* pe;
+    int cat_id;
+
+    if (cat_name) {
+        if ((cat_id = find_cat_id(p->cat_table, cat_name)) < 0) return false;
+        pe = writer_cat_entry(p, cat_id);
+    } else if (app_hash) {
+        pe = rhashtable_lookup_fast(&p->apps, app_hash, policy_params);
+    } else {
+        return false;
+    }
+
+    if (!pe) return false;
+
+    unlink_entry(p, pe);
+    return true;
+}
+
+void seng_policy_flush (struct seng_policy* p) {
+    struct seng_policy_entry *pe, *tmp;
+
+    list_for_each_entry_safe (pe, tmp, &p->entries, list_node) {
+        unlink_entry(p, pe);
+    }
+}
+
+const struct seng_policy_entry* seng_policy_lookup (struct seng_policy* p, const struct app* a) {
+    const struct seng_policy_entry* pe;
+    unsigned long cat_id;
+
+    pe = rhashtable_lookup(&p->apps, a->app_hash, policy_params);
+    if (pe) return pe;
+
+    // most maps only contain app entries
+    if (!READ_ONCE(p->n_cats)) return NULL;
+
+    for_each_set_bit (cat_id, a->categories, SENG_MAX_CATEGORIES) {
+        pe = rcu_dereference(p->cats[cat_id]);
+        if (pe) return pe;
+    }
+
+    return NULL;
+}
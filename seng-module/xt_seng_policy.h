@@ -0,0 +1,114 @@
+#ifndef SENG_XT_SENG_POLICY_H
+#define SENG_XT_SENG_POLICY_H
+
+#include <linux/rhashtable.h>
+#include <linux/list.h>
+#include <linux/mutex.h>
+#include <linux/rcupdate.h>
+
+#include "xt_seng_genl.h"
+
+struct app;
+struct seng_cats;
+
+/**
+ * @brief one entry of the policy map
+ *
+ * Keyed either by an app hash or by an interned category.
+ * */
+struct seng_policy_entry {
+    uint8_t app_hash[SGX_HASH_SIZE];    ///< key of app entries
+    uint16_t cat_id;                    ///< key of category entries (holds a reference to the interned category)
+    bool is_cat;                        ///< the entry is keyed by a category
+    uint8_t verdict;                    ///< the verdict (see enum seng_policy_verdict)
+    bool has_mark;                      ///< the entry has a mark
+    uint32_t mark;                      ///< the mark (set by SENGMAP, written into the packet or conntrack mark by SENGMARK)
+    struct rhash_head node;             ///< hash table node of app entries
+    struct list_head list_node;         ///< linked list node (writer only)
+    struct rcu_head rcu;                ///< used for deferred freeing
+};
+
+/**
+ * @brief the policy map of a network namespace
+ *
+ * Maps app hashes and categories to verdicts and marks, which the SENGMAP target applies with a single lookup
+ * instead of one rule per app. Independent of the database generations, i.e., it survives staged resyncs.
+ * Read under RCU by the packet path, modified with the mutex of the namespace held.
+ * */
+struct seng_policy {
+    struct rhashtable apps;                                     ///< app entries keyed by their app hash
+    struct seng_policy_entry __rcu *cats[SENG_MAX_CATEGORIES];  ///< category entries indexed by the interned category id
+    unsigned int n_cats;                                        ///< amount of category entries
+    struct list_head entries;                                   ///< list of all entries (writer only)
+    struct mutex* lock;                                         ///< writer lock of the owning namespace
+    struct seng_cats* cat_table;                                ///< category table of the owning namespace
+};
+
+/**
+ * @brief initializes an empty policy map
+ *
+ * @param[out] p        the policy map
+ * @param[in] lock      writer lock of the owning namespace
+ * @param[in] cats      category table of the owning namespace
+ *
+ * @return 0 on success, else a negative error code
+ * */
+int seng_policy_init (struct seng_policy* p, struct mutex* lock, struct seng_cats* cats);
+
+/**
+ * @brief frees all entries of a policy map and the map itself
+ *
+ * The packet path must not be able to reach the map anymore.
+ *
+ * @param[in] p         the policy map
+ * */
+void seng_policy_destroy (struct seng_policy* p);
+
+/**
+ * @brief adds or replaces an entry of the policy map
+ *
+ * Exactly one of app_hash and cat_name must be given.
+ *
+ * @param[in] p             the policy map
+ * @param[in] app_hash      the app hash of an app entry (or NULL)
+ * @param[in] cat_name      the category name of a category entry (or NULL)
+ * @param[in] verdict       the verdict (see enum seng_policy_verdict)
+ * @param[in] mark          the packet mark (or NULL to keep the mark of the packet)
+ *
+ * @return 0 on success, else a negative error code
+ * */
+int seng_policy_set (struct seng_policy* p, const uint8_t* app_hash, const char* cat_name, uint8_t verdict, const uint32_t* mark);
+
+/**
+ * @brief deletes an entry of the policy map
+ *
+ * @param[in] p             the policy map
+ * @param[in] app_hash      the app hash of an app entry (or NULL)
+ * @param[in] cat_name      the category name of a category entry (or NULL)
+ *
+ * @return true on success, false if there is no such entry
+ * */
+bool seng_policy_del (struct seng_policy* p, const uint8_t* app_hash, const char* cat_name);
+
+/**
+ * @brief deletes all entries of the policy map
+ *
+ * @param[in] p         the policy map
+ * */
+void seng_policy_flush (struct seng_policy* p);
+
+/**
+ * @brief looks up the policy of an app
+ *
+ * The entry of the app hash takes precedence over the category entries. If several categories of the app
+ * have an entry, the one with the lowest interned category id applies, i.e., category entries should be disjoint.
+ * Must be called inside an RCU read-side critical section.
+ *
+ * @param[in] p         the policy map
+ * @param[in] a         the app
+ *
+ * @return the entry, or NULL if the app has no policy
+ * */
+const struct seng_policy_entry* seng_policy_lookup (struct seng_policy* p, const struct app* a);
+
+#endif
@@ -0,0 +1,95 @@
+#include <linux/kernel.h>
+#include <linux/module.h>
+
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+
+#include "xt_seng_stats.h"
+
+DEFINE_PER_CPU(struct seng_stats, seng_stats);
+
+/**
+ * @brief names of the counters in the statistics file
+ * */
+static const char * const seng_stat_names[__SENG_STAT_MAX] = {
+    [SENG_STAT_MATCH_CALLS]     = "match_calls",
+    [SENG_STAT_MATCHED]         = "matched",
+    [SENG_STAT_HOTDROPS]        = "hotdrops",
+    [SENG_STAT_CACHE_HITS]      = "cache_hits",
+    [SENG_STAT_CT_HITS]         = "ct_hits",
+    [SENG_STAT_LOOKUPS]         = "lookups",
+    [SENG_STAT_LOOKUP_MISSES]   = "lookup_misses",
+    [SENG_STAT_PRED_HOST]       = "pred_host",
+    [SENG_STAT_PRED_CAT]        = "pred_cat",
+    [SENG_STAT_PRED_APP]        = "pred_app",
+    [SENG_STAT_PRED_FAILS]      = "pred_fails",
+};
+
+/**
+ * @brief the debugfs directory of the module
+ * */
+static struct dentry *seng_debugfs;
+
+/**
+ * @brief prints the counters summed up over all cpus
+ *
+ * @param[in] m         the seq_file
+ * @param[in] v         unused
+ *
+ * @return 0
+ * */
+static int seng_stats_show (struct seq_file *m, void *v) {
+    u64 sum[__SENG_STAT_MAX] = { 0 };
+    int cpu, i;
+
+    for_each_possible_cpu (cpu) {
+        const struct seng_stats *s = per_cpu_ptr(&seng_stats, cpu);
+
+        for (i = 0; i < __SENG_STAT_MAX; i++) sum[i] += READ_ONCE(s->ctr[i]);
+    }
+
+    for (i = 0; i < __SENG_STAT_MAX; i++) seq_printf(m, "%-16s %llu\n", seng_stat_names[i], sum[i]);
+
+    return 0;
+}
+
+/**
+ * @brief opens the statistics file
+ * */
+static int seng_stats_open (struct inode *inode, struct file *file) {
+    return single_open(file, seng_stats_show, NULL);
+}
+
+static const struct file_operations seng_stats_fops = {
+    .owner = THIS_MODULE,
+    .open = seng_stats_open,
+    .read = seq_read,
+    .llseek = seq_lseek,
+    .release = single_release,
+};
+
+int seng_stats_init (void) {
+    struct dentry *file;
+
+    seng_debugfs = debugfs_create_dir("xt_seng", NULL);
+    if (IS_ERR_OR_NULL(seng_debugfs)) {
+        int err = seng_debugfs ? PTR_ERR(seng_debugfs) : -ENOMEM;
+
+        seng_debugfs = NULL;
+        // kernel without debugfs
+        return err == -ENODEV ? 0 : err;
+    }
+
+    file = debugfs_create_file("stats", 0444, seng_debugfs, NULL, &seng_stats_fops);
+    if (IS_ERR_OR_NULL(file)) {
+        debugfs_remove_recursive(seng_debugfs);
+        seng_debugfs = NULL;
+        return file ? PTR_ERR(file) : -ENOMEM;
+    }
+
+    return 0;
+}
+
+void seng_stats_exit (void) {
+    debugfs_remove_recursive(seng_debugfs);
+}
@@ -0,0 +1,61 @@
+#ifndef SENG_XT_SENG_STATS_H
+#define SENG_XT_SENG_STATS_H
+
+#include <linux/percpu.h>
+
+/**
+ * @brief counters of the match path
+ *
+ * Used as index into @link seng_stats @endlink.
+ * */
+enum seng_stat {
+    SENG_STAT_MATCH_CALLS,      ///< calls of the match function
+    SENG_STAT_MATCHED,          ///< calls which matched the rule
+    SENG_STAT_HOTDROPS,         ///< packets dropped by the match function
+    SENG_STAT_CACHE_HITS,       ///< sides resolved by the per-packet lookup cache
+    SENG_STAT_CT_HITS,          ///< sides resolved by the conntrack labels of the flow (ct_cache mode)
+    SENG_STAT_LOOKUPS,          ///< database lookups
+    SENG_STAT_LOOKUP_MISSES,    ///< database lookups which found no enclave
+    SENG_STAT_PRED_HOST,        ///< evaluated host predicates
+    SENG_STAT_PRED_CAT,         ///< evaluated category predicates
+    SENG_STAT_PRED_APP,         ///< evaluated app predicates
+    SENG_STAT_PRED_FAILS,       ///< predicates which failed the match (incl. unknown enclaves)
+    __SENG_STAT_MAX,            ///< amount of counters
+};
+
+/**
+ * @brief per-cpu match statistics
+ *
+ * Only written by the local cpu and aggregated on read, i.e., the packet path uses no shared atomics.
+ * */
+struct seng_stats {
+    u64 ctr[__SENG_STAT_MAX];   ///< the counters
+};
+
+DECLARE_PER_CPU(struct seng_stats, seng_stats);
+
+/**
+ * @brief increments a counter of the local cpu
+ *
+ * @param[in] stat      the counter
+ * */
+static inline void seng_stat_inc (enum seng_stat stat) {
+    this_cpu_inc(seng_stats.ctr[stat]);
+}
+
+/**
+ * @brief creates the statistics file
+ *
+ * Exposes the aggregated counters as /sys/kernel/debug/xt_seng/stats.
+ * A kernel without debugfs is not an error.
+ *
+ * @return 0 on success, else a negative error code
+ * */
+int seng_stats_init (void);
+
+/**
+ * @brief removes the statistics file
+ * */
+void seng_stats_exit (void);
+
+#endif
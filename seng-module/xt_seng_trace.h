@@ -0,0 +1,185 @@
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM seng
+
+#if !defined(SENG_XT_SENG_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define SENG_XT_SENG_TRACE_H
+
+#include <linux/tracepoint.h>
+#include <linux/netfilter.h>
+#include <linux/in6.h>
+#include <net/ipv6.h> //ipv6_addr_set_v4mapped
+
+#include "xt_seng_genl.h"
+
+/**
+ * @brief copies an enclave address into a trace entry
+ *
+ * IPv4 addresses are stored v4-mapped, so that all events print addresses with %pI6c.
+ * */
+#define SENG_TRACE_ADDR(dst, family, addr) do {                                         \
+    if ((family) == NFPROTO_IPV6) memcpy((dst), (addr), sizeof(struct in6_addr));       \
+    else ipv6_addr_set_v4mapped(*(const uint32_t *) (addr), (struct in6_addr *) (dst)); \
+} while (0)
+
+/**
+ * @brief lookup of one side of a packet in the database
+ *
+ * Only fired for actual lookups, not for sides resolved by the per-packet cache.
+ * */
+TRACE_EVENT(seng_lookup,
+    TP_PROTO(uint8_t family, const void *addr, uint8_t dir, bool found),
+    TP_ARGS(family, addr, dir, found),
+    TP_STRUCT__entry(
+        __array(uint8_t, addr, sizeof(struct in6_addr))
+        __field(uint8_t, dir)
+        __field(bool, found)
+    ),
+    TP_fast_assign(
+        SENG_TRACE_ADDR(__entry->addr, family, addr);
+        __entry->dir = dir;
+        __entry->found = found;
+    ),
+    TP_printk("%s=%pI6c found=%d", __entry->dir ? "dst" : "src", __entry->addr, __entry->found)
+);
+
+/**
+ * @brief result of a seng rule program
+ * */
+TRACE_EVENT(seng_match,
+    TP_PROTO(const void *prog, uint8_t family, bool matched),
+    TP_ARGS(prog, family, matched),
+    TP_STRUCT__entry(
+        __field(const void *, prog)
+        __field(uint8_t, family)
+        __field(bool, matched)
+    ),
+    TP_fast_assign(
+        __entry->prog = prog;
+        __entry->family = family;
+        __entry->matched = matched;
+    ),
+    TP_printk("prog=%p family=%u matched=%d", __entry->prog, __entry->family, __entry->matched)
+);
+
+DECLARE_EVENT_CLASS(seng_enclave,
+    TP_PROTO(uint8_t family, const void *addr, int err),
+    TP_ARGS(family, addr, err),
+    TP_STRUCT__entry(
+        __array(uint8_t, addr, sizeof(struct in6_addr))
+        __field(int, err)
+    ),
+    TP_fast_assign(
+        SENG_TRACE_ADDR(__entry->addr, family, addr);
+        __entry->err = err;
+    ),
+    TP_printk("enclave=%pI6c err=%d", __entry->addr, __entry->err)
+);
+
+/// enclave added via generic netlink
+DEFINE_EVENT(seng_enclave, seng_enclave_add,
+    TP_PROTO(uint8_t family, const void *addr, int err),
+    TP_ARGS(family, addr, err)
+);
+
+/// enclave removed via generic netlink
+DEFINE_EVENT(seng_enclave, seng_enclave_rmv,
+    TP_PROTO(uint8_t family, const void *addr, int err),
+    TP_ARGS(family, addr, err)
+);
+
+DECLARE_EVENT_CLASS(seng_app,
+    TP_PROTO(const uint8_t *app_hash),
+    TP_ARGS(app_hash),
+    TP_STRUCT__entry(
+        __array(uint8_t, app_hash, SGX_HASH_SIZE)
+    ),
+    TP_fast_assign(
+        memcpy(__entry->app_hash, app_hash, SGX_HASH_SIZE);
+    ),
+    TP_printk("app=%*phN", SGX_HASH_SIZE, __entry->app_hash)
+);
+
+/// app added to a database
+DEFINE_EVENT(seng_app, seng_app_add,
+    TP_PROTO(const uint8_t *app_hash),
+    TP_ARGS(app_hash)
+);
+
+/// app deleted from a database
+DEFINE_EVENT(seng_app, seng_app_del,
+    TP_PROTO(const uint8_t *app_hash),
+    TP_ARGS(app_hash)
+);
+
+DECLARE_EVENT_CLASS(seng_cat,
+    TP_PROTO(const uint8_t *app_hash, const char *cat_name, int err),
+    TP_ARGS(app_hash, cat_name, err),
+    TP_STRUCT__entry(
+        __array(uint8_t, app_hash, SGX_HASH_SIZE)
+        __array(char, cat_name, MAX_CAT_NAME_LENGTH)
+        __field(int, err)
+    ),
+    TP_fast_assign(
+        memcpy(__entry->app_hash, app_hash, SGX_HASH_SIZE);
+        strlcpy(__entry->cat_name, cat_name, MAX_CAT_NAME_LENGTH);
+        __entry->err = err;
+    ),
+    TP_printk("app=%*phN cat=%s err=%d", SGX_HASH_SIZE, __entry->app_hash, __entry->cat_name, __entry->err)
+);
+
+/// category added to an app
+DEFINE_EVENT(seng_cat, seng_cat_add,
+    TP_PROTO(const uint8_t *app_hash, const char *cat_name, int err),
+    TP_ARGS(app_hash, cat_name, err)
+);
+
+/// category deleted from an app
+DEFINE_EVENT(seng_cat, seng_cat_del,
+    TP_PROTO(const uint8_t *app_hash, const char *cat_name, int err),
+    TP_ARGS(app_hash, cat_name, err)
+);
+
+/**
+ * @brief category name interned into the global category table
+ * */
+TRACE_EVENT(seng_cat_intern,
+    TP_PROTO(const char *cat_name, int id),
+    TP_ARGS(cat_name, id),
+    TP_STRUCT__entry(
+        __array(char, cat_name, MAX_CAT_NAME_LENGTH)
+        __field(int, id)
+    ),
+    TP_fast_assign(
+        strlcpy(__entry->cat_name, cat_name, MAX_CAT_NAME_LENGTH);
+        __entry->id = id;
+    ),
+    TP_printk("cat=%s id=%d", __entry->cat_name, __entry->id)
+);
+
+/**
+ * @brief any other generic netlink operation
+ *
+ * The value is the result of the operation (0 or a negative error code), or its count (e.g., of deleted conntrack entries).
+ * */
+TRACE_EVENT(seng_op,
+    TP_PROTO(const char *op, int val),
+    TP_ARGS(op, val),
+    TP_STRUCT__entry(
+        __string(op, op)
+        __field(int, val)
+    ),
+    TP_fast_assign(
+        __assign_str(op, op);
+        __entry->val = val;
+    ),
+    TP_printk("%s %d", __get_str(op), __entry->val)
+);
+
+#endif
+
+/* out-of-tree module, the header is found via -I$(src) */
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE xt_seng_trace
+#include <trace/define_trace.h>
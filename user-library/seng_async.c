@@ -0,0 +1,309 @@
+#include <errno.h> //ENOMEM, ENOBUFS
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/socket.h> //setsockopt
+#include <linux/netlink.h> //NETLINK_CAP_ACK
+#include <netlink/genl/genl.h> //genl
+#include <netlink/errno.h> //NLE_*
+
+#include "seng_netfilter.h"
+
+/**
+ * @brief asynchronous netlink socket
+ *
+ * Non-blocking socket used by the seng_async_*() functions, separate from nlsock.
+ * Will be initialized by seng_async_open()
+ * */
+static struct nl_sock* asock;
+
+/// callbacks used for receiving the ACKs on asock
+static struct nl_cb* acb;
+
+/// completion callback of the caller and its argument
+static seng_async_cb async_cb;
+static void* async_arg;
+
+/// amount of submitted operations without completion
+static unsigned int async_pending;
+
+/**
+ * @brief pending operation
+ *
+ * The kernel module processes the messages in order, so the pending operations form a FIFO.
+ * The conntrack entries of a removed enclave are deleted once its removal has been acknowledged.
+ * */
+struct async_op {
+    uint32_t seq;                   ///< sequence number of the message
+    bool removal;                   ///< the operation removes enclave_ip
+    uint32_t enclave_ip;            ///< the removed enclave
+    struct async_op* next;          ///< next pending operation
+};
+
+static struct async_op *ops_head, *ops_tail;
+
+/// Removes the head of the FIFO and reports its completion.
+/**
+* @param[in] err   0 on success, -ENOBUFS if the ACK was lost, else the negative errno reported by the kernel module.
+*/
+static void finish_head (int err) {
+    struct async_op* op = ops_head;
+    int ret;
+
+    ops_head = op->next;
+    if (!ops_head) ops_tail = NULL;
+    async_pending--;
+
+    // the outcome of a removal with lost ACK is unknown, so its conntrack entries are deleted either way
+    if (op->removal && (!err || err == -ENOBUFS) && ct_flush_mode == SENG_CT_FLUSH_USER) {
+        ret = delete_conntrack_entries(op->enclave_ip);
+        if (ret == -1) printf("SENG: failed deleting conntrack entries associated with %d\n", op->enclave_ip);
+    }
+
+    if (async_cb) async_cb(op->seq, err, async_arg);
+    free(op);
+}
+
+/// Completes the operation with sequence number seq.
+/**
+* The operations submitted before it have lost their ACKs (full receive buffer) and fail with -ENOBUFS.
+* ACKs of unknown operations are ignored.
+*
+* @param[in] seq   The sequence number of the completed operation.
+* @param[in] err   0 on success, else the negative errno reported by the kernel module.
+*/
+static void complete_op (uint32_t seq, int err) {
+    struct async_op* op;
+
+    for (op = ops_head; op && op->seq != seq; op = op->next);
+    if (!op) return;
+
+    while (ops_head != op) finish_head(-ENOBUFS);
+    finish_head(err);
+}
+
+/// libnl callback for successful ACKs
+static int ack_handler (struct nl_msg* msg, void* arg) {
+    (void) arg;
+    complete_op(nlmsg_hdr(msg)->nlmsg_seq, 0);
+    return NL_OK;
+}
+
+/// libnl callback for error ACKs
+static int error_handler (struct sockaddr_nl* nla, struct nlmsgerr* e, void* arg) {
+    (void) nla;
+    (void) arg;
+    complete_op(e->msg.nlmsg_seq, e->error);
+    return NL_SKIP;
+}
+
+/// libnl callback disabling the sequence check, as many messages are in flight
+static int seq_handler (struct nl_msg* msg, void* arg) {
+    (void) msg;
+    (void) arg;
+    return NL_OK;
+}
+
+/// Sends a message with NLM_F_ACK on asock without waiting.
+/**
+* @param[in]  msg          The message to be sent. (freed)
+* @param[in]  enclave_ip   The enclave removed by the message. (only for removals)
+* @param[out] seq          The sequence number of the message. (optional)
+* \return EXIT_SUCCESS or error codes (-NLE_AGAIN if the socket buffer is full)
+*/
+static int async_send (struct nl_msg* msg, const uint32_t* enclave_ip, uint32_t* seq) {
+    struct async_op* op;
+    int err;
+
+    if (!asock) {
+        nlmsg_free(msg);
+        return -NLE_BAD_SOCK;
+    }
+
+    op = malloc(sizeof(*op));
+    if (!op) {
+        nlmsg_free(msg);
+        return -NLE_NOMEM;
+    }
+
+    nlmsg_hdr(msg)->nlmsg_flags |= NLM_F_ACK;
+
+    err = nl_send_auto(asock, msg);
+    if (err < 0) {
+        free(op);
+        nlmsg_free(msg);
+        return err;
+    }
+
+    op->seq = nlmsg_hdr(msg)->nlmsg_seq;
+    op->removal = enclave_ip != NULL;
+    op->enclave_ip = enclave_ip ? *enclave_ip : 0;
+    op->next = NULL;
+    if (ops_tail) ops_tail->next = op;
+    else ops_head = op;
+    ops_tail = op;
+
+    if (seq) *seq = op->seq;
+    async_pending++;
+
+    nlmsg_free(msg);
+    return EXIT_SUCCESS;
+}
+
+int seng_async_open (seng_async_cb cb, void* arg) {
+    int one = 1;
+
+    if (asock) return EXIT_FAILURE;
+
+    asock = nl_socket_alloc();
+    if (!asock) {
+        fprintf(stderr, "SENG: Unable to alloc async nl socket!\n");
+        return -ENOMEM;
+    }
+
+    if (genl_connect(asock)) {
+        fprintf(stderr, "SENG: Unable to connect async socket to genl!\n");
+        goto exit_err;
+    }
+
+    if (nl_socket_set_nonblocking(asock)) {
+        fprintf(stderr, "SENG: Unable to make async socket non-blocking!\n");
+        goto exit_err;
+    }
+
+    /* room for many ACKs in flight */
+    nl_socket_set_buffer_size(asock, SENG_ASYNC_RCVBUF_SIZE, 0);
+
+    /* error ACKs only echo the header instead of the whole message (best effort) */
+    setsockopt(nl_socket_get_fd(asock), SOL_NETLINK, NETLINK_CAP_ACK, &one, sizeof(one));
+
+    acb = nl_cb_alloc(NL_CB_DEFAULT);
+    if (!acb) {
+        fprintf(stderr, "SENG: Unable to alloc async callbacks!\n");
+        goto exit_err;
+    }
+
+    nl_cb_set(acb, NL_CB_ACK, NL_CB_CUSTOM, ack_handler, NULL);
+    nl_cb_set(acb, NL_CB_SEQ_CHECK, NL_CB_CUSTOM, seq_handler, NULL);
+    nl_cb_err(acb, NL_CB_CUSTOM, error_handler, NULL);
+
+    async_cb = cb;
+    async_arg = arg;
+    async_pending = 0;
+
+    return EXIT_SUCCESS;
+
+    exit_err:
+    nl_socket_free(asock);
+    asock = NULL;
+    return EXIT_FAILURE;
+}
+
+int seng_async_close (void) {
+    struct async_op* op;
+
+    if (!asock) return EXIT_FAILURE;
+
+    while ((op = ops_head)) {
+        ops_head = op->next;
+        free(op);
+    }
+    ops_tail = NULL;
+
+    nl_cb_put(acb);
+    acb = NULL;
+    nl_socket_free(asock);
+    asock = NULL;
+    async_cb = NULL;
+    async_pending = 0;
+
+    return EXIT_SUCCESS;
+}
+
+int seng_async_fd (void) {
+    if (!asock) return -1;
+    return nl_socket_get_fd(asock);
+}
+
+unsigned int seng_async_pending (void) {
+    return async_pending;
+}
+
+int seng_async_process (void) {
+    unsigned int before = async_pending;
+    bool lost = false;
+    int err;
+
+    if (!asock) return -NLE_BAD_SOCK;
+
+    // an overflowed receive buffer still holds the ACKs queued before the overflow
+    do {
+        err = nl_recvmsgs(asock, acb);
+        if (err == -NLE_NOMEM) lost = true;
+    } while (err >= 0 || err == -NLE_NOMEM);
+
+    if (err != -NLE_AGAIN) {
+        fprintf(stderr, "SENG: Failed receiving async ACKs! (%s)\n", nl_geterror(err));
+        return err;
+    }
+
+    // the kernel module acknowledges during the submission, so the ACKs of the remaining operations were lost
+    if (lost) {
+        while (ops_head) finish_head(-ENOBUFS);
+        return -NLE_NOMEM;
+    }
+
+    return before - async_pending;
+}
+
+int seng_async_add_enclave (uint32_t enclave_ip, const uint8_t* app_hash, uint32_t host, const char* cat_name, uint32_t* seq) {
+    struct nl_msg* msg;
+    int err;
+
+    err = build_add_enclave_msg(&msg, enclave_ip, app_hash, host, cat_name);
+    if (err) return err;
+
+    return async_send(msg, NULL, seq);
+}
+
+int seng_async_add_enclaves_batch (const struct seng_enclave_entry* entries, size_t n, uint32_t* seq) {
+    struct nl_msg* msg;
+    int err;
+
+    if (n > SENG_BATCH_MAX_ENTRIES) return -NLE_RANGE;
+
+    err = build_batch_msg(&msg, entries, n);
+    if (err) return err;
+
+    return async_send(msg, NULL, seq);
+}
+
+int seng_async_cat_to_app (const uint8_t* app_hash, const char* cat_name, uint32_t* seq) {
+    struct nl_msg* msg;
+    int err;
+
+    err = build_cat_msg(&msg, app_hash, cat_name, XT_SENG_ATTR_ADD);
+    if (err) return err;
+
+    return async_send(msg, NULL, seq);
+}
+
+int seng_async_remove_cat_from_app (const uint8_t* app_hash, const char* cat_name, uint32_t* seq) {
+    struct nl_msg* msg;
+    int err;
+
+    err = build_cat_msg(&msg, app_hash, cat_name, XT_SENG_ATTR_RMV);
+    if (err) return err;
+
+    return async_send(msg, NULL, seq);
+}
+
+int seng_async_remove_enclave (uint32_t enclave_ip, uint32_t* seq) {
+    struct nl_msg* msg;
+    int err;
+
+    err = build_remove_enclave_msg(&msg, enclave_ip);
+    if (err) return err;
+
+    return async_send(msg, &enclave_ip, seq);
+}
@@ -5,112 +5,175 @@
 #include <string.h>
 #include <errno.h>
 
-#include <unistd.h>
-#include <assert.h>
+#include <stdbool.h>
 
 #include <libnetfilter_conntrack/libnetfilter_conntrack.h>
 
 struct cb_data {
     unsigned int removed;
-    uint32_t enclave_ip;
+    const uint32_t* enclave_ips;    // sorted
+    size_t n;
 };
 
+/**
+ * @brief long-lived conntrack handles
+ *
+ * Opened by prep_nl_sock() (or on first use). Dumps and deletions need separate handles,
+ * as the deletions happen inside the dump callback.
+ * */
+static struct nfct_handle *dump_h, *destroy_h;
+
+static int cmp_ip(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a;
+    uint32_t y = *(const uint32_t *)b;
+
+    return (x > y) - (x < y);
+}
+
+static bool is_removed(const struct cb_data *dp, uint32_t ip)
+{
+    return bsearch(&ip, dp->enclave_ips, dp->n, sizeof(uint32_t), cmp_ip) != NULL;
+}
+
 static int cb(enum nf_conntrack_msg_type type,
               struct nf_conntrack *ct,
               void *data)
 {
     int ret;
     struct cb_data *dp = (struct cb_data *)data;
-    struct nfct_handle *h;
 
     uint32_t src_ip = nfct_get_attr_u32(ct, ATTR_IPV4_SRC);
     uint32_t dst_ip = nfct_get_attr_u32(ct, ATTR_IPV4_DST);
 
-    if (src_ip != dp->enclave_ip && dst_ip != dp->enclave_ip)
+    // also needed for filtered dumps, as older kernels ignore the filter
+    if (!is_removed(dp, src_ip) && !is_removed(dp, dst_ip))
         goto end;
 
-    h = nfct_open(CONNTRACK, 0);
-    if (!h) {
-        perror("nfct_open");
-        return -1;
-    }
-
-    // TODO: re-using query handle worked, but returned -1
-    ret = nfct_query(h, NFCT_Q_DESTROY, ct);
+    ret = nfct_query(destroy_h, NFCT_Q_DESTROY, ct);
     if (ret == -1)
-        printf("SENG: error in deletion of conntrack entries for %d : (%d)(%s)\n", dp->enclave_ip, ret, (char *) strerror(errno));
+        printf("SENG: error in deletion of conntrack entries for %d : (%d)(%s)\n", src_ip, ret, (char *) strerror(errno));
     else
         dp->removed += 1;
 
-    nfct_close(h);
-
 end:
     return NFCT_CB_CONTINUE;
 }
 
-static int change_privs(uid_t new_euid, gid_t new_egid, bool drop) {
-    uid_t old_euid = geteuid();
-    gid_t old_egid = getegid();
-    // already done
-    if (old_euid == new_euid && old_egid == new_egid) return 0;
-
-//    printf("change_privs: %d,%d --> %d,%d\n", old_euid, old_egid, new_euid, new_egid);
-    if (!drop) {
-        if( seteuid(new_euid) < 0 ) { fprintf(stderr, "Failed to swap privs to %d", new_euid); return -1; }
-        if( setegid(new_egid) < 0 ) { int ret; do {ret = seteuid(old_euid); perror("change_privs");} while(ret < 0); return -1; }
-    } else {
-        if( setegid(new_egid) < 0 ) { fprintf(stderr, "Failed to drop privs to %d", new_egid); return -1; }
-        if( seteuid(new_euid) < 0 ) { int ret; do {ret = setegid(old_egid); perror("change_privs");} while(ret < 0); return -1; }
+int open_conntrack_handles(void)
+{
+    if (!dump_h && !(dump_h = nfct_open(CONNTRACK, 0))) {
+        perror("nfct_open");
+        return -1;
+    }
+
+    if (!destroy_h && !(destroy_h = nfct_open(CONNTRACK, 0))) {
+        perror("nfct_open");
+        return -1;
     }
+
     return 0;
 }
 
-static int _delete_conntrack_entries (uint32_t pEnclave_ip);
+void close_conntrack_handles(void)
+{
+    if (dump_h) nfct_close(dump_h);
+    if (destroy_h) nfct_close(destroy_h);
+    dump_h = destroy_h = NULL;
+}
+
+static int _delete_conntrack_entries (const uint32_t* enclave_ips, size_t n);
 
 int delete_conntrack_entries(uint32_t enclave_ip) {
-        int result;
-        uid_t old_euid = geteuid();
-        gid_t old_egid = getegid();
+    return _delete_conntrack_entries(&enclave_ip, 1);
+}
 
-        // TODO: use CAP_NET_ADMIN instead of root privs.
-        // elevate to root
-        if(change_privs(0,0,false) != 0) return -1;
-        assert(geteuid() == 0 && getegid() == 0);
+int delete_conntrack_entries_batch(const uint32_t* enclave_ips, size_t n) {
+    if (n == 0) return 0;
+    return _delete_conntrack_entries(enclave_ips, n);
+}
 
-        // actual conntrack code
-        result = _delete_conntrack_entries(enclave_ip);
+static int dump_filtered (struct cb_data *d, const struct nfct_filter_dump *filter_dump)
+{
+    int ret;
 
-        // revert privs
-        if(change_privs(old_euid,old_egid,true) != 0) {
-            fprintf(stderr, "Failed to revert SENG Server privileges to %d, %d!\n", old_euid, old_egid);
-        }
+    nfct_callback_register(dump_h, NFCT_T_ALL, cb, d);
+    ret = nfct_query(dump_h, NFCT_Q_DUMP_FILTER, filter_dump);
+    nfct_callback_unregister(dump_h);
 
-        return result;
-    }
+    if (ret == -1)
+        printf("SENG: error during receive of conntrack entries : (%d)(%s)\n", ret, (char *) strerror(errno));
 
-static int _delete_conntrack_entries (uint32_t pEnclave_ip)
+    return ret;
+}
+
+#ifdef HAVE_NFCT_FILTER_DUMP_TUPLE
+/* dumps only the entries with the given original source (ATTR_IPV4_SRC) or destination (ATTR_IPV4_DST) */
+static int dump_tuple (struct cb_data *d, enum nf_conntrack_attr attr, uint32_t ip)
 {
-    int ret;
-    u_int32_t family = AF_INET;
-    struct nfct_handle *h;
+    struct nfct_filter_dump *filter_dump;
+    struct nf_conntrack *tuple;
+    int ret = -1;
+
+    filter_dump = nfct_filter_dump_create();
+    tuple = nfct_new();
+    if (!filter_dump || !tuple) goto out;
+
+    nfct_set_attr_u8(tuple, ATTR_L3PROTO, AF_INET);
+    nfct_set_attr_u32(tuple, attr, ip);
+
+    nfct_filter_dump_set_attr_u8(filter_dump, NFCT_FILTER_DUMP_L3NUM, AF_INET);
+    nfct_filter_dump_set_attr(filter_dump, NFCT_FILTER_DUMP_TUPLE, tuple);
+
+    ret = dump_filtered(d, filter_dump);
+
+out:
+    if (tuple) nfct_destroy(tuple);
+    if (filter_dump) nfct_filter_dump_destroy(filter_dump);
+    return ret;
+}
+#endif
+
+static int _delete_conntrack_entries (const uint32_t* enclave_ips, size_t n)
+{
+    int ret = -1;
+    struct nfct_filter_dump *filter_dump;
+    uint32_t *sorted;
 
     struct cb_data d;
-    d.enclave_ip = pEnclave_ip;
     d.removed = 0;
+    d.n = n;
 
-    h = nfct_open(CONNTRACK, 0);
-    if (!h) {
-        perror("nfct_open");
+    if (open_conntrack_handles())
         return -1;
+
+    sorted = malloc(n * sizeof(uint32_t));
+    if (!sorted)
+        return -1;
+    memcpy(sorted, enclave_ips, n * sizeof(uint32_t));
+    qsort(sorted, n, sizeof(uint32_t), cmp_ip);
+    d.enclave_ips = sorted;
+
+#ifdef HAVE_NFCT_FILTER_DUMP_TUPLE
+    // a single enclave: let the kernel select its entries (Linux 5.8+)
+    if (n == 1) {
+        ret = dump_tuple(&d, ATTR_IPV4_SRC, sorted[0]);
+        if (ret != -1)
+            ret = dump_tuple(&d, ATTR_IPV4_DST, sorted[0]);
+        goto out;
     }
+#endif
 
-    nfct_callback_register(h, NFCT_T_ALL, cb, &d);
-    ret = nfct_query(h, NFCT_Q_DUMP, &family);
+    // a single pass over the ipv4 entries for all enclaves
+    filter_dump = nfct_filter_dump_create();
+    if (!filter_dump)
+        goto out;
 
-    if (ret == -1)
-        printf("SENG: error during receive of conntrack entries for %d : (%d)(%s)\n", d.enclave_ip, ret, (char *) strerror(errno));
+    nfct_filter_dump_set_attr_u8(filter_dump, NFCT_FILTER_DUMP_L3NUM, AF_INET);
+    ret = dump_filtered(&d, filter_dump);
+    nfct_filter_dump_destroy(filter_dump);
 
-    nfct_close(h);
-
-    return ret == -1 ? ret : d.removed;
-}
\ No newline at end of file
+out:
+    free(sorted);
+    return ret == -1 ? ret : (int) d.removed;
+}
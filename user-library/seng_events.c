@@ -0,0 +1,155 @@
+#include <errno.h> //ENOMEM
+#include <stdio.h>
+#include <stdlib.h>
+#include <netlink/genl/genl.h> //genl
+#include <netlink/genl/ctrl.h> //genl_ctrl_resolve_grp
+#include <netlink/errno.h> //NLE_*
+
+#include "seng_netfilter.h"
+
+/**
+ * @brief event netlink socket
+ *
+ * Non-blocking socket joined to the multicast group of the kernel module, separate from nlsock.
+ * Will be initialized by seng_events_open()
+ * */
+static struct nl_sock* esock;
+
+/// callbacks used for receiving the events on esock
+static struct nl_cb* ecb;
+
+/// event callback of the caller and its argument
+static seng_event_cb event_cb;
+static void* event_arg;
+
+/// amount of events received by the current seng_events_process() call
+static int event_count;
+
+/// libnl callback for received events
+static int event_handler (struct nl_msg* msg, void* arg) {
+    struct nlattr* attrs[XT_SENG_ATTR_MAX + 1];
+    struct genlmsghdr* gnlh = nlmsg_data(nlmsg_hdr(msg));
+    struct seng_event ev = { 0 };
+    (void) arg;
+
+    if (gnlh->cmd != GENL_XT_SENG_EVENT) return NL_SKIP;
+
+    if (genlmsg_parse(nlmsg_hdr(msg), 0, attrs, XT_SENG_ATTR_MAX, NULL) || !attrs[XT_SENG_ATTR_EVENT]) {
+        fprintf(stderr, "SENG: Received malformed event!\n");
+        return NL_SKIP;
+    }
+
+    ev.type = nla_get_u32(attrs[XT_SENG_ATTR_EVENT]);
+    if (attrs[XT_SENG_ATTR_ENC]) ev.enclave_ip = nla_get_u32(attrs[XT_SENG_ATTR_ENC]);
+    if (attrs[XT_SENG_ATTR_HOST]) ev.host = nla_get_u32(attrs[XT_SENG_ATTR_HOST]);
+    if (attrs[XT_SENG_ATTR_APP] && nla_len(attrs[XT_SENG_ATTR_APP]) == SGX_HASH_SIZE) ev.app_hash = nla_data(attrs[XT_SENG_ATTR_APP]);
+    if (attrs[XT_SENG_ATTR_ENC6] && nla_len(attrs[XT_SENG_ATTR_ENC6]) == sizeof(struct in6_addr)) ev.enclave_ip6 = nla_data(attrs[XT_SENG_ATTR_ENC6]);
+    if (attrs[XT_SENG_ATTR_HOST6] && nla_len(attrs[XT_SENG_ATTR_HOST6]) == sizeof(struct in6_addr)) ev.host6 = nla_data(attrs[XT_SENG_ATTR_HOST6]);
+    if (attrs[XT_SENG_ATTR_CAT]) ev.cat_name = nla_get_string(attrs[XT_SENG_ATTR_CAT]);
+    if (attrs[XT_SENG_ATTR_SUBNET]) ev.subnet = nla_get_u32(attrs[XT_SENG_ATTR_SUBNET]);
+    if (attrs[XT_SENG_ATTR_PREFIX]) ev.prefix_len = nla_get_u32(attrs[XT_SENG_ATTR_PREFIX]);
+
+    event_count++;
+    if (event_cb) event_cb(&ev, event_arg);
+
+    return NL_OK;
+}
+
+/// libnl callback disabling the sequence check, as events are unsolicited
+static int seq_handler (struct nl_msg* msg, void* arg) {
+    (void) msg;
+    (void) arg;
+    return NL_OK;
+}
+
+int seng_events_open (seng_event_cb cb, void* arg) {
+    int grp_id;
+
+    if (esock) return EXIT_FAILURE;
+
+    esock = nl_socket_alloc();
+    if (!esock) {
+        fprintf(stderr, "SENG: Unable to alloc event nl socket!\n");
+        return -ENOMEM;
+    }
+
+    if (genl_connect(esock)) {
+        fprintf(stderr, "SENG: Unable to connect event socket to genl!\n");
+        goto exit_err;
+    }
+
+    /* resolved on the event socket itself, so subscribers do not need prep_nl_sock() */
+    grp_id = genl_ctrl_resolve_grp(esock, GENL_SENG_FAMILY_NAME, GENL_SENG_MCGRP_NAME);
+    if (grp_id < 0) {
+        fprintf(stderr, "SENG: Unable to resolve multicast group!\n");
+        goto exit_err;
+    }
+
+    if (nl_socket_add_membership(esock, grp_id)) {
+        fprintf(stderr, "SENG: Unable to join group %d!\n", grp_id);
+        goto exit_err;
+    }
+
+    if (nl_socket_set_nonblocking(esock)) {
+        fprintf(stderr, "SENG: Unable to make event socket non-blocking!\n");
+        goto exit_err;
+    }
+
+    /* room for bursts like batches between two seng_events_process() calls */
+    nl_socket_set_buffer_size(esock, SENG_EVENTS_RCVBUF_SIZE, 0);
+
+    ecb = nl_cb_alloc(NL_CB_DEFAULT);
+    if (!ecb) {
+        fprintf(stderr, "SENG: Unable to alloc event callbacks!\n");
+        goto exit_err;
+    }
+
+    nl_cb_set(ecb, NL_CB_VALID, NL_CB_CUSTOM, event_handler, NULL);
+    nl_cb_set(ecb, NL_CB_SEQ_CHECK, NL_CB_CUSTOM, seq_handler, NULL);
+
+    event_cb = cb;
+    event_arg = arg;
+
+    return EXIT_SUCCESS;
+
+    exit_err:
+    nl_socket_free(esock);
+    esock = NULL;
+    return EXIT_FAILURE;
+}
+
+int seng_events_close (void) {
+    if (!esock) return EXIT_FAILURE;
+
+    nl_cb_put(ecb);
+    ecb = NULL;
+    nl_socket_free(esock);
+    esock = NULL;
+    event_cb = NULL;
+
+    return EXIT_SUCCESS;
+}
+
+int seng_events_fd (void) {
+    if (!esock) return -1;
+    return nl_socket_get_fd(esock);
+}
+
+int seng_events_process (void) {
+    int err;
+
+    if (!esock) return -NLE_BAD_SOCK;
+
+    event_count = 0;
+
+    do {
+        err = nl_recvmsgs(esock, ecb);
+    } while (err >= 0);
+
+    if (err != -NLE_AGAIN) {
+        fprintf(stderr, "SENG: Failed receiving events! (%s)\n", nl_geterror(err));
+        return err;
+    }
+
+    return event_count;
+}
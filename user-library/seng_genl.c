@@ -1,7 +1,10 @@
 #include <errno.h> //ENOMEM
 #include <assert.h>
+#include <string.h> //memcpy
+#include <stdbool.h>
 #include <netlink/genl/ctrl.h> //genl
 #include <netlink/genl/genl.h> //genl
+#include <netlink/errno.h> //NLE_*
 
 #include "seng_netfilter.h"
 #include "xt_seng_genl.h"
@@ -29,10 +32,91 @@ struct nla_policy genl_seng_policy[XT_SENG_ATTR_MAX+1] = {
                 .type = NLA_U32,
                 .maxlen = sizeof(uint32_t)
         },
+
+        [XT_SENG_ATTR_SUBNET] = {
+                .type = NLA_U32,
+                .maxlen = sizeof(uint32_t)
+        },
+
+        [XT_SENG_ATTR_PREFIX] = {
+                .type = NLA_U32,
+                .maxlen = sizeof(uint32_t)
+        },
+
+        [XT_SENG_ATTR_BATCH] = {
+                .type = NLA_NESTED,
+        },
+
+        [XT_SENG_ATTR_ENTRY] = {
+                .type = NLA_NESTED,
+        },
+
+        [XT_SENG_ATTR_CATS] = {
+                .type = NLA_NESTED,
+        },
+
+        [XT_SENG_ATTR_ENC6] = {
+                .type = NLA_BINARY,
+                .maxlen = sizeof(struct in6_addr)
+        },
+
+        [XT_SENG_ATTR_HOST6] = {
+                .type = NLA_BINARY,
+                .maxlen = sizeof(struct in6_addr)
+        },
+
+        [XT_SENG_ATTR_VERDICT] = {
+                .type = NLA_U32,
+                .maxlen = sizeof(uint32_t)
+        },
+
+        [XT_SENG_ATTR_MARK] = {
+                .type = NLA_U32,
+                .maxlen = sizeof(uint32_t)
+        },
 };
 
+enum seng_ct_flush_mode ct_flush_mode = SENG_CT_FLUSH_KERNEL;
+
+/**
+ * @brief cached generic netlink family id of the kernel module
+ *
+ * Resolved once by prep_nl_sock() and only re-resolved after the family vanished (module reload).
+ * */
+static int seng_family_id = -1;
+
+/// Returns the generic netlink family id of the kernel module, resolving it only if not cached yet.
+/**
+* \return the family id or a negative error code
+*/
+static int get_family_id (void) {
+    if (seng_family_id < 0) {
+        seng_family_id = genl_ctrl_resolve(nlsock, GENL_SENG_FAMILY_NAME);
+    }
+    return seng_family_id;
+}
+
+/// Sends a message to the kernel module and waits for the ACK.
+/**
+* Invalidates the cached family id if the kernel module does not know it (anymore),
+* such that the next (repeated) message re-resolves it.
+*
+* @param[in] msg    The message to be sent. (freed)
+* \return 0 or the negative libnl error code
+*/
+static int send_sync (struct nl_msg* msg) {
+    int err = nl_send_sync(nlsock, msg);
+
+    if (err < 0) {
+        fprintf(stderr, "SENG: Failed to send nl message!\n");
+        if (err == -NLE_OBJ_NOTFOUND) seng_family_id = -1;
+    }
+
+    return err;
+}
+
 int prep_nl_sock (void) {
-    int family_id, grp_id;
+    int family_id;
 
     nlsock = nl_socket_alloc();
     if(!nlsock) {
@@ -46,18 +130,17 @@ int prep_nl_sock (void) {
         goto exit_err;
     }
 
-    /* resolve the generic nl family id*/
-    family_id = genl_ctrl_resolve(nlsock, GENL_SENG_FAMILY_NAME);
+    /* resolve the generic nl family id (cached for all further messages) */
+    seng_family_id = -1;
+    family_id = get_family_id();
     if(family_id < 0){
         fprintf(stderr, "SENG: Unable to resolve family name!\n");
         goto exit_err;
     }
 
-    grp_id = genl_ctrl_resolve_grp(nlsock, GENL_SENG_FAMILY_NAME, GENL_SENG_MCGRP_NAME);
-
-    if (nl_socket_add_membership(nlsock, grp_id)) {
-        fprintf(stderr, "Unable to join group %u!\n", grp_id);
-        goto exit_err;
+    /* the user-space conntrack deletion reuses them for all removals (retried on first use) */
+    if (open_conntrack_handles()) {
+        fprintf(stderr, "SENG: Unable to open conntrack handles!\n");
     }
 
     return EXIT_SUCCESS;
@@ -69,22 +152,29 @@ int prep_nl_sock (void) {
 
 int cleanup_nl_sock(void) {
     if(!nlsock) return EXIT_FAILURE;
+    seng_family_id = -1;
+    close_conntrack_handles();
     nl_socket_free(nlsock);
     return EXIT_SUCCESS;
 }
 
-int add_enclave (uint32_t enclave, const uint8_t* app_hash, uint32_t host, const char* cat_name) {
+/// Allocates a netlink message and puts the generic netlink header for the kernel module.
+/**
+* @param[out] msgp   The allocated message.
+* @param[in]  size   The message size. (0 for the default size)
+* \return EXIT_SUCCESS or error codes
+*/
+static int alloc_seng_msg (struct nl_msg** msgp, size_t size) {
     struct nl_msg* msg;
     int family_id;
-    int err = 0;
 
-    family_id = genl_ctrl_resolve(nlsock, GENL_SENG_FAMILY_NAME);
+    family_id = get_family_id();
     if(family_id < 0){
         fprintf(stderr, "SENG: Unable to resolve family name!\n");
         return -1;
     }
 
-    msg = nlmsg_alloc();
+    msg = size ? nlmsg_alloc_size(size) : nlmsg_alloc();
     if (!msg) {
         fprintf(stderr, "SENG: Failed to allocate netlink message\n");
         return -ENOMEM;
@@ -92,10 +182,21 @@ int add_enclave (uint32_t enclave, const uint8_t* app_hash, uint32_t host, const
 
     if(!genlmsg_put(msg, NL_AUTO_PID, NL_AUTO_SEQ, family_id, 0, NLM_F_REQUEST, GENL_XT_SENG_MSG, 0)) {
         fprintf(stderr, "SENG: Failed to put nl_hdr!\n");
-        err = -ENOMEM;
-        goto out;
+        nlmsg_free(msg);
+        return -ENOMEM;
     }
 
+    *msgp = msg;
+    return EXIT_SUCCESS;
+}
+
+int build_add_enclave_msg (struct nl_msg** msgp, uint32_t enclave, const uint8_t* app_hash, uint32_t host, const char* cat_name) {
+    struct nl_msg* msg;
+    int err;
+
+    err = alloc_seng_msg(&msg, 0);
+    if (err) return err;
+
     err = nla_put_u32(msg, XT_SENG_ATTR_HOST, host);
     if (err) {
         fprintf(stderr, "SENG: Failed to put host!\n");
@@ -129,62 +230,90 @@ int add_enclave (uint32_t enclave, const uint8_t* app_hash, uint32_t host, const
         goto out;
     }
 
-    err = nl_send_sync(nlsock, msg);
-    if (err < 0) fprintf(stderr, "SENG: Failed to send nl message!\n");
-
-    return err;
+    *msgp = msg;
+    return EXIT_SUCCESS;
 
     out:
         nlmsg_free(msg);
         return err;
 }
 
-int add_enclave_ack (uint32_t enclave, const uint8_t* app_hash, uint32_t host, const char* cat_name) {
-    int ret;
-    int i = 0;
+int build_batch_msg (struct nl_msg** msgp, const struct seng_enclave_entry* entries, size_t n) {
+    struct nl_msg* msg;
+    struct nlattr *batch, *entry;
+    int err;
+    size_t i;
 
-    repeat_msg:
+    err = alloc_seng_msg(&msg, SENG_BATCH_MSG_SIZE);
+    if (err) return err;
 
-        if (i > 4) {
-            printf("SENG: failed sending message %i times - aborting...\n", i);
-            return -1;
+    batch = nla_nest_start(msg, XT_SENG_ATTR_BATCH);
+    if (!batch) {
+        fprintf(stderr, "SENG: Failed to start batch!\n");
+        err = -ENOMEM;
+        goto out;
+    }
+
+    for (i = 0; i < n; i++) {
+        entry = nla_nest_start(msg, XT_SENG_ATTR_ENTRY);
+        if (!entry) {
+            fprintf(stderr, "SENG: Failed to start batch entry!\n");
+            err = -ENOMEM;
+            goto out;
         }
 
-        //send message
-        ret = add_enclave (enclave, app_hash, host, cat_name);
+        err = nla_put_u32(msg, XT_SENG_ATTR_ENC, entries[i].enclave_ip);
+        if (err) {
+            fprintf(stderr, "SENG: Failed to put enclave!\n");
+            goto out;
+        }
 
-        if (ret < 0) {
-            printf("SENG: Did not send message! - %i\n", i);
-            i += 1;
-            goto repeat_msg;
+        err = nla_put(msg, XT_SENG_ATTR_APP, SGX_HASH_SIZE, entries[i].app_hash);
+        if (err) {
+            fprintf(stderr, "SENG: Failed to put app name!\n");
+            goto out;
         }
 
-    return 0;
-}
+        err = nla_put_u32(msg, XT_SENG_ATTR_HOST, entries[i].host);
+        if (err) {
+            fprintf(stderr, "SENG: Failed to put host!\n");
+            goto out;
+        }
 
-int cat_to_app (const uint8_t* app_hash, const char* cat_name) {
-    struct nl_msg* msg;
-    int family_id;
-    int err = 0;
+        if (entries[i].cat_name) {
+            err = nla_put_string(msg, XT_SENG_ATTR_CAT, entries[i].cat_name);
+            if (err) {
+                fprintf(stderr, "SENG: Failed to put cat name!\n");
+                goto out;
+            }
+        }
 
-    family_id = genl_ctrl_resolve(nlsock, GENL_SENG_FAMILY_NAME);
-    if(family_id < 0){
-        fprintf(stderr, "SENG: Unable to resolve family name!\n");
-        return -1;
+        nla_nest_end(msg, entry);
     }
 
-    msg = nlmsg_alloc();
-    if (!msg) {
-        fprintf(stderr, "SENG: Failed to allocate netlink message\n");
-        return -ENOMEM;
-    }
+    nla_nest_end(msg, batch);
 
-    if(!genlmsg_put(msg, NL_AUTO_PID, NL_AUTO_SEQ, family_id, 0, NLM_F_REQUEST, GENL_XT_SENG_MSG, 0)) {
-        fprintf(stderr, "SENG: Failed to put nl_hdr!\n");
-        err = -ENOMEM;
+    err = nla_put_flag(msg, XT_SENG_ATTR_ADD);
+    if (err) {
+        fprintf(stderr, "SENG: Failed to set add flag!\n");
         goto out;
     }
 
+    *msgp = msg;
+    return EXIT_SUCCESS;
+
+    out:
+        nlmsg_free(msg);
+        return err;
+}
+
+int build_cat_msg (struct nl_msg** msgp, const uint8_t* app_hash, const char* cat_name, int op) {
+    struct nl_msg* msg;
+    int err;
+
+    err = alloc_seng_msg(&msg, 0);
+    if (err) return err;
+
     err = nla_put(msg, XT_SENG_ATTR_APP, SGX_HASH_SIZE, app_hash);
     if (err) {
         fprintf(stderr, "SENG: Failed to put app name!\n");
@@ -199,42 +328,65 @@ int cat_to_app (const uint8_t* app_hash, const char* cat_name) {
         }
     }
 
-    err = nla_put_flag(msg, XT_SENG_ATTR_ADD);
+    err = nla_put_flag(msg, op);
     if (err) {
         fprintf(stderr, "SENG: Failed to set operation flag!\n");
         goto out;
     }
 
-    err = nl_send_sync(nlsock, msg);
-    if (err < 0) fprintf(stderr, "SENG: Failed to send nl message!\n");
-
-    return err;
+    *msgp = msg;
+    return EXIT_SUCCESS;
 
     out:
         nlmsg_free(msg);
         return err;
 }
 
-int remove_cat_from_app (const uint8_t* app_hash, const char* cat_name) {
+int build_remove_enclave_msg (struct nl_msg** msgp, uint32_t enclave) {
     struct nl_msg* msg;
-    int family_id;
-    int err = 0;
+    int err;
 
-    family_id = genl_ctrl_resolve(nlsock, GENL_SENG_FAMILY_NAME);
-    if(family_id < 0){
-        fprintf(stderr, "SENG: Unable to resolve family name!\n");
-        return -1;
+    err = alloc_seng_msg(&msg, 0);
+    if (err) return err;
+
+    err = nla_put_u32(msg, XT_SENG_ATTR_ENC, enclave);
+    if (err) {
+        fprintf(stderr, "SENG: Failed to put enclave!\n");
+        goto out;
     }
 
-    msg = nlmsg_alloc();
-    if (!msg) {
-        fprintf(stderr, "SENG: Failed to allocate netlink message\n");
-        return -ENOMEM;
+    err = nla_put_flag(msg, XT_SENG_ATTR_RMV);
+    if (err) {
+        fprintf(stderr, "SENG: Failed to set operation flag!\n");
+        goto out;
     }
 
-    if(!genlmsg_put(msg, NL_AUTO_PID, NL_AUTO_SEQ, family_id, 0, NLM_F_REQUEST, GENL_XT_SENG_MSG, 0)) {
-        fprintf(stderr, "SENG: Failed to put nl_hdr!\n");
-        err = -ENOMEM;
+    if (ct_flush_mode == SENG_CT_FLUSH_KERNEL) {
+        err = nla_put_flag(msg, XT_SENG_ATTR_CT_FLUSH);
+        if (err) {
+            fprintf(stderr, "SENG: Failed to set conntrack flush flag!\n");
+            goto out;
+        }
+    }
+
+    *msgp = msg;
+    return EXIT_SUCCESS;
+
+    out:
+        nlmsg_free(msg);
+        return err;
+}
+
+int build_add_enclave6_msg (struct nl_msg** msgp, const struct in6_addr* enclave, const uint8_t* app_hash, const struct in6_addr* host, const char* cat_name) {
+    struct nl_msg* msg;
+    int err;
+
+    err = alloc_seng_msg(&msg, 0);
+    if (err) return err;
+
+    err = nla_put(msg, XT_SENG_ATTR_HOST6, sizeof(*host), host);
+    if (err) {
+        fprintf(stderr, "SENG: Failed to put host!\n");
         goto out;
     }
 
@@ -252,113 +404,331 @@ int remove_cat_from_app (const uint8_t* app_hash, const char* cat_name) {
         }
     }
 
-    err = nla_put_flag(msg, XT_SENG_ATTR_RMV);
+    err = nla_put_flag(msg, XT_SENG_ATTR_ADD);
     if (err) {
-        fprintf(stderr, "SENG: Failed to set operation flag!\n");
+        fprintf(stderr, "SENG: Failed to set add flag!\n");
         goto out;
     }
 
-    err = nl_send_sync(nlsock, msg);
-    if (err < 0) fprintf(stderr, "SENG: Failed to send nl message!\n");
+    err = nla_put(msg, XT_SENG_ATTR_ENC6, sizeof(*enclave), enclave);
+    if (err) {
+        fprintf(stderr, "SENG: Failed to put enclave!\n");
+        goto out;
+    }
 
-    return err;
+    *msgp = msg;
+    return EXIT_SUCCESS;
 
     out:
-    nlmsg_free(msg);
-    return err;
+        nlmsg_free(msg);
+        return err;
 }
 
-int cat_to_app_ack (const uint8_t* app_hash, const char* cat_name) {
-    int ret;
-    int i = 0;
+int build_remove_enclave6_msg (struct nl_msg** msgp, const struct in6_addr* enclave) {
+    struct nl_msg* msg;
+    int err;
 
-    repeat_msg:
+    err = alloc_seng_msg(&msg, 0);
+    if (err) return err;
 
-    if (i > 4) {
-        printf("SENG: failed sending message %i times - aborting...\n", i);
-        return -1;
+    err = nla_put(msg, XT_SENG_ATTR_ENC6, sizeof(*enclave), enclave);
+    if (err) {
+        fprintf(stderr, "SENG: Failed to put enclave!\n");
+        goto out;
     }
 
-    //send message
-    ret = cat_to_app (app_hash, cat_name);
-
-    if (ret < 0) {
-        printf("SENG: Did not send message! - %i\n", i);
-        i += 1;
-        goto repeat_msg;
+    err = nla_put_flag(msg, XT_SENG_ATTR_RMV);
+    if (err) {
+        fprintf(stderr, "SENG: Failed to set operation flag!\n");
+        goto out;
     }
 
-    return 0;
-}
-
-int remove_cat_from_app_ack (const uint8_t* app_hash, const char* cat_name) {
-    int ret;
-    int i = 0;
-
-    repeat_msg:
-
-    if (i > 4) {
-        printf("SENG: failed sending message %i times - aborting...\n", i);
-        return -1;
+    // the user-space conntrack deletion only covers ipv4
+    err = nla_put_flag(msg, XT_SENG_ATTR_CT_FLUSH);
+    if (err) {
+        fprintf(stderr, "SENG: Failed to set conntrack flush flag!\n");
+        goto out;
     }
 
-    //send message
-    ret = remove_cat_from_app (app_hash, cat_name);
-
-    if (ret < 0) {
-        printf("SENG: Did not send message! - %i\n", i);
-        i += 1;
-        goto repeat_msg;
-    }
+    *msgp = msg;
+    return EXIT_SUCCESS;
 
-    return 0;
+    out:
+        nlmsg_free(msg);
+        return err;
 }
 
-int remove_enclave (uint32_t enclave) {
+int build_subnet_msg (struct nl_msg** msgp, uint32_t subnet, uint32_t prefix_len, int op) {
     struct nl_msg* msg;
-    int family_id;
-    int err = 0;
-
-    family_id = genl_ctrl_resolve(nlsock, GENL_SENG_FAMILY_NAME);
-    if(family_id < 0){
-        fprintf(stderr, "SENG: Unable to resolve family name!\n");
-        return -1;
-    }
+    int err;
 
-    msg = nlmsg_alloc();
-    if (!msg) {
-        fprintf(stderr, "SENG: Failed to allocate netlink message\n");
-        return -ENOMEM;
-    }
+    err = alloc_seng_msg(&msg, 0);
+    if (err) return err;
 
-    if(!genlmsg_put(msg, NL_AUTO_PID, NL_AUTO_SEQ, family_id, 0, NLM_F_REQUEST, GENL_XT_SENG_MSG, 0)) {
-        fprintf(stderr, "SENG: Failed to put nl_hdr!\n");
-        err = -ENOMEM;
+    err = nla_put_u32(msg, XT_SENG_ATTR_SUBNET, subnet);
+    if (err) {
+        fprintf(stderr, "SENG: Failed to put subnet!\n");
         goto out;
     }
 
-    err = nla_put_u32(msg, XT_SENG_ATTR_ENC, enclave);
-    if (err) {
-        fprintf(stderr, "SENG: Failed to put enclave!\n");
-        goto out;
+    if (op == XT_SENG_ATTR_ADD) {
+        err = nla_put_u32(msg, XT_SENG_ATTR_PREFIX, prefix_len);
+        if (err) {
+            fprintf(stderr, "SENG: Failed to put prefix length!\n");
+            goto out;
+        }
     }
 
-    err = nla_put_flag(msg, XT_SENG_ATTR_RMV);
+    err = nla_put_flag(msg, op);
     if (err) {
         fprintf(stderr, "SENG: Failed to set operation flag!\n");
         goto out;
     }
 
-    err = nl_send_sync(nlsock, msg);
-    if (err < 0) fprintf(stderr, "SENG: Failed to send nl message!\n");
+    *msgp = msg;
+    return EXIT_SUCCESS;
 
-    return err;
+    out:
+        nlmsg_free(msg);
+        return err;
+}
+
+int build_policy_msg (struct nl_msg** msgp, const uint8_t* app_hash, const char* cat_name, uint32_t verdict, const uint32_t* mark, int op) {
+    struct nl_msg* msg;
+    int err;
+
+    err = alloc_seng_msg(&msg, 0);
+    if (err) return err;
+
+    err = nla_put_flag(msg, XT_SENG_ATTR_POLICY);
+    if (err) {
+        fprintf(stderr, "SENG: Failed to set policy flag!\n");
+        goto out;
+    }
+
+    if (app_hash) {
+        err = nla_put(msg, XT_SENG_ATTR_APP, SGX_HASH_SIZE, app_hash);
+        if (err) {
+            fprintf(stderr, "SENG: Failed to put app name!\n");
+            goto out;
+        }
+    } else if (cat_name) {
+        err = nla_put_string(msg, XT_SENG_ATTR_CAT, cat_name);
+        if (err) {
+            fprintf(stderr, "SENG: Failed to put cat name!\n");
+            goto out;
+        }
+    }
+
+    if (op == XT_SENG_ATTR_ADD) {
+        err = nla_put_u32(msg, XT_SENG_ATTR_VERDICT, verdict);
+        if (err) {
+            fprintf(stderr, "SENG: Failed to put verdict!\n");
+            goto out;
+        }
+
+        if (mark) {
+            err = nla_put_u32(msg, XT_SENG_ATTR_MARK, *mark);
+            if (err) {
+                fprintf(stderr, "SENG: Failed to put mark!\n");
+                goto out;
+            }
+        }
+    }
+
+    err = nla_put_flag(msg, op);
+    if (err) {
+        fprintf(stderr, "SENG: Failed to set operation flag!\n");
+        goto out;
+    }
+
+    *msgp = msg;
+    return EXIT_SUCCESS;
 
     out:
         nlmsg_free(msg);
         return err;
 }
 
+int build_signal_msg (struct nl_msg** msgp, int signal) {
+    struct nl_msg* msg;
+    int err;
+
+    err = alloc_seng_msg(&msg, 0);
+    if (err) return err;
+
+    err = nla_put_flag(msg, signal);
+    if (err) {
+        fprintf(stderr, "SENG: Failed to set signal flag!\n");
+        nlmsg_free(msg);
+        return err;
+    }
+
+    *msgp = msg;
+    return EXIT_SUCCESS;
+}
+
+int add_enclave (uint32_t enclave, const uint8_t* app_hash, uint32_t host, const char* cat_name) {
+    struct nl_msg* msg;
+    int err;
+
+    err = build_add_enclave_msg(&msg, enclave, app_hash, host, cat_name);
+    if (err) return err;
+
+    return send_sync(msg);
+}
+
+int add_enclave_ack (uint32_t enclave, const uint8_t* app_hash, uint32_t host, const char* cat_name) {
+    int ret;
+    int i = 0;
+
+    repeat_msg:
+
+        if (i > 4) {
+            printf("SENG: failed sending message %i times - aborting...\n", i);
+            return -1;
+        }
+
+        //send message
+        ret = add_enclave (enclave, app_hash, host, cat_name);
+
+        if (ret < 0) {
+            printf("SENG: Did not send message! - %i\n", i);
+            i += 1;
+            goto repeat_msg;
+        }
+
+    return 0;
+}
+
+/// Sends a single batch message with up to SENG_BATCH_MAX_ENTRIES enclaves to the kernel module.
+/**
+* @param[in] entries   The enclaves to be added.
+* @param[in] n         The amount of enclaves.
+* @param[in] staged    Add the enclaves to the staged instead of the active database.
+* \return EXIT_SUCCESS or error codes
+*/
+int add_enclaves_batch_msg (const struct seng_enclave_entry* entries, size_t n, bool staged) {
+    struct nl_msg* msg;
+    int err;
+
+    err = build_batch_msg(&msg, entries, n);
+    if (err) return err;
+
+    if (staged && (err = nla_put_flag(msg, XT_SENG_ATTR_STAGED))) {
+        fprintf(stderr, "SENG: Failed to set staged flag!\n");
+        nlmsg_free(msg);
+        return err;
+    }
+
+    return send_sync(msg);
+}
+
+/// Sends the enclaves in batch messages of up to SENG_BATCH_MAX_ENTRIES entries.
+/**
+* @param[in] entries   The enclaves to be added.
+* @param[in] n         The amount of enclaves.
+* @param[in] staged    Add the enclaves to the staged instead of the active database.
+* \return EXIT_SUCCESS or the error code of the last failed message
+*/
+static int send_batches (const struct seng_enclave_entry* entries, size_t n, bool staged) {
+    size_t off, chunk;
+    int ret;
+    int err = 0;
+
+    for (off = 0; off < n; off += chunk) {
+        chunk = n - off < SENG_BATCH_MAX_ENTRIES ? n - off : SENG_BATCH_MAX_ENTRIES;
+
+        ret = add_enclaves_batch_msg(&entries[off], chunk, staged);
+        if (ret < 0) {
+            printf("SENG: failed adding batch of enclaves %zu to %zu!\n", off, off + chunk - 1);
+            err = ret;
+        }
+    }
+
+    return err;
+}
+
+int add_enclaves_batch (const struct seng_enclave_entry* entries, size_t n) {
+    return send_batches(entries, n, false);
+}
+
+int cat_to_app (const uint8_t* app_hash, const char* cat_name) {
+    struct nl_msg* msg;
+    int err;
+
+    err = build_cat_msg(&msg, app_hash, cat_name, XT_SENG_ATTR_ADD);
+    if (err) return err;
+
+    return send_sync(msg);
+}
+
+int remove_cat_from_app (const uint8_t* app_hash, const char* cat_name) {
+    struct nl_msg* msg;
+    int err;
+
+    err = build_cat_msg(&msg, app_hash, cat_name, XT_SENG_ATTR_RMV);
+    if (err) return err;
+
+    return send_sync(msg);
+}
+
+int cat_to_app_ack (const uint8_t* app_hash, const char* cat_name) {
+    int ret;
+    int i = 0;
+
+    repeat_msg:
+
+    if (i > 4) {
+        printf("SENG: failed sending message %i times - aborting...\n", i);
+        return -1;
+    }
+
+    //send message
+    ret = cat_to_app (app_hash, cat_name);
+
+    if (ret < 0) {
+        printf("SENG: Did not send message! - %i\n", i);
+        i += 1;
+        goto repeat_msg;
+    }
+
+    return 0;
+}
+
+int remove_cat_from_app_ack (const uint8_t* app_hash, const char* cat_name) {
+    int ret;
+    int i = 0;
+
+    repeat_msg:
+
+    if (i > 4) {
+        printf("SENG: failed sending message %i times - aborting...\n", i);
+        return -1;
+    }
+
+    //send message
+    ret = remove_cat_from_app (app_hash, cat_name);
+
+    if (ret < 0) {
+        printf("SENG: Did not send message! - %i\n", i);
+        i += 1;
+        goto repeat_msg;
+    }
+
+    return 0;
+}
+
+int remove_enclave (uint32_t enclave) {
+    struct nl_msg* msg;
+    int err;
+
+    err = build_remove_enclave_msg(&msg, enclave);
+    if (err) return err;
+
+    return send_sync(msg);
+}
+
 int remove_enclave_ack (uint32_t enclave) {
     int ret;
     int i = 0;
@@ -379,6 +749,9 @@ int remove_enclave_ack (uint32_t enclave) {
         goto repeat_msg;
     }
 
+    // already done by the kernel module
+    if (ct_flush_mode != SENG_CT_FLUSH_USER) return 0;
+
     ret = delete_conntrack_entries(enclave);
 
     if (ret == -1) {
@@ -390,48 +763,215 @@ int remove_enclave_ack (uint32_t enclave) {
     return 0;
 }
 
-/// Simply sends a signal to the kernel module.
+/// Sends the message for adding an ipv6 enclave once.
 /**
-* @param[in] signal   The signal to be sent.
+* \return 0 or error codes
+*/
+static int add_enclave6 (const struct in6_addr* enclave, const uint8_t* app_hash, const struct in6_addr* host, const char* cat_name) {
+    struct nl_msg* msg;
+    int err;
+
+    err = build_add_enclave6_msg(&msg, enclave, app_hash, host, cat_name);
+    if (err) return err;
+
+    return send_sync(msg);
+}
+
+int add_enclave6_ack (const struct in6_addr* enclave, const uint8_t* app_hash, const struct in6_addr* host, const char* cat_name) {
+    int ret;
+    int i = 0;
+
+    repeat_msg:
+
+        if (i > 4) {
+            printf("SENG: failed sending message %i times - aborting...\n", i);
+            return -1;
+        }
+
+        ret = add_enclave6 (enclave, app_hash, host, cat_name);
+
+        if (ret < 0) {
+            printf("SENG: Did not send message! - %i\n", i);
+            i += 1;
+            goto repeat_msg;
+        }
+
+    return 0;
+}
+
+/// Sends the message for removing an ipv6 enclave once.
+/**
+* \return 0 or error codes
+*/
+static int remove_enclave6 (const struct in6_addr* enclave) {
+    struct nl_msg* msg;
+    int err;
+
+    err = build_remove_enclave6_msg(&msg, enclave);
+    if (err) return err;
+
+    return send_sync(msg);
+}
+
+int remove_enclave6_ack (const struct in6_addr* enclave) {
+    int ret;
+    int i = 0;
+
+    repeat_msg:
+
+    if (i > 4) {
+        printf("SENG: failed sending message %i times - aborting...\n", i);
+        return -1;
+    }
+
+    ret = remove_enclave6 (enclave);
+
+    if (ret < 0) {
+        printf("SENG: Did not send message! - %i\n", i);
+        i += 1;
+        goto repeat_msg;
+    }
+
+    return 0;
+}
+
+/// Enables (op = XT_SENG_ATTR_ADD) or disables (op = XT_SENG_ATTR_RMV) subnet mode in the kernel module.
+/**
+* @param[in] subnet       The enclave subnet base address. (network byte order)
+* @param[in] prefix_len   The enclave subnet prefix length. (ignored for XT_SENG_ATTR_RMV)
+* @param[in] op           The operation flag.
 * \return EXIT_SUCCESS or error codes
 */
-int send_signal (int signal) {
-    struct nl_msg *msg;
-    int family_id;
-    int err = 0;
+int enclave_subnet (uint32_t subnet, uint32_t prefix_len, int op) {
+    struct nl_msg* msg;
+    int err;
 
-    family_id = genl_ctrl_resolve(nlsock, GENL_SENG_FAMILY_NAME);
-    if (family_id < 0) {
-        fprintf(stderr, "SENG: Unable to resolve family name in send_signal! - %i\n", signal);
-        return EXIT_FAILURE;
+    err = build_subnet_msg(&msg, subnet, prefix_len, op);
+    if (err) return err;
+
+    return send_sync(msg);
+}
+
+int set_enclave_subnet_ack (uint32_t subnet, uint32_t prefix_len) {
+    int ret;
+    int i = 0;
+
+    if (prefix_len < SENG_SUBNET_MIN_PREFIX || prefix_len > 32) {
+        fprintf(stderr, "SENG: Invalid enclave subnet prefix length %u!\n", prefix_len);
+        return -1;
     }
 
-    msg = nlmsg_alloc();
-    if (!msg) {
-        fprintf(stderr, "SENG: Failed to allocate netlink message\n");
-        return -ENOMEM;
+    repeat_msg:
+
+    if (i > 4) {
+        printf("SENG: failed sending message %i times - aborting...\n", i);
+        return -1;
     }
 
-    if (!genlmsg_put(msg, NL_AUTO_PID, NL_AUTO_SEQ, family_id, 0, NLM_F_REQUEST, GENL_XT_SENG_MSG, 0)) {
-        fprintf(stderr, "SENG: Failed to put nl_hdr!\n");
-        err = -ENOMEM;
-        goto out;
+    //send message
+    ret = enclave_subnet (subnet, prefix_len, XT_SENG_ATTR_ADD);
+
+    if (ret < 0) {
+        printf("SENG: Did not send message! - %i\n", i);
+        i += 1;
+        goto repeat_msg;
     }
 
-    err = nla_put_flag(msg, signal);
-    if (err) {
-        fprintf(stderr, "SENG: Failed to set signal flag!\n");
-        goto out;
+    return 0;
+}
+
+int clear_enclave_subnet_ack (void) {
+    int ret;
+    int i = 0;
+
+    repeat_msg:
+
+    if (i > 4) {
+        printf("SENG: failed sending message %i times - aborting...\n", i);
+        return -1;
     }
 
-    err = nl_send_sync(nlsock, msg);
-    if (err < 0) fprintf(stderr, "SENG: Failed to send nl message!\n");
+    //send message
+    ret = enclave_subnet (0, 0, XT_SENG_ATTR_RMV);
 
-    return err;
+    if (ret < 0) {
+        printf("SENG: Did not send message! - %i\n", i);
+        i += 1;
+        goto repeat_msg;
+    }
 
-    out:
-        nlmsg_free(msg);
-        return err;
+    return 0;
+}
+
+/// Sends an operation on the policy map with retrial mechanism.
+/**
+* @param[in] app_hash   The app hash of an app entry. (or NULL)
+* @param[in] cat_name   The category name of a category entry. (or NULL)
+* @param[in] verdict    The verdict. (XT_SENG_ATTR_ADD only)
+* @param[in] mark       The packet mark. (XT_SENG_ATTR_ADD only, may be NULL)
+* @param[in] op         The operation flag.
+* \return EXIT_SUCCESS or error codes
+*/
+static int policy_ack (const uint8_t* app_hash, const char* cat_name, uint32_t verdict, const uint32_t* mark, int op) {
+    struct nl_msg* msg;
+    int ret;
+    int i = 0;
+
+    repeat_msg:
+
+    if (i > 4) {
+        printf("SENG: failed sending message %i times - aborting...\n", i);
+        return -1;
+    }
+
+    ret = build_policy_msg(&msg, app_hash, cat_name, verdict, mark, op);
+    if (ret) return ret;
+
+    //send message
+    ret = send_sync(msg);
+
+    if (ret < 0) {
+        printf("SENG: Did not send message! - %i\n", i);
+        i += 1;
+        goto repeat_msg;
+    }
+
+    return 0;
+}
+
+int set_app_policy_ack (const uint8_t* app_hash, enum seng_policy_verdict verdict, const uint32_t* mark) {
+    return policy_ack(app_hash, NULL, verdict, mark, XT_SENG_ATTR_ADD);
+}
+
+int set_cat_policy_ack (const char* cat_name, enum seng_policy_verdict verdict, const uint32_t* mark) {
+    return policy_ack(NULL, cat_name, verdict, mark, XT_SENG_ATTR_ADD);
+}
+
+int remove_app_policy_ack (const uint8_t* app_hash) {
+    return policy_ack(app_hash, NULL, 0, NULL, XT_SENG_ATTR_RMV);
+}
+
+int remove_cat_policy_ack (const char* cat_name) {
+    return policy_ack(NULL, cat_name, 0, NULL, XT_SENG_ATTR_RMV);
+}
+
+int flush_policy_ack (void) {
+    return policy_ack(NULL, NULL, 0, NULL, XT_SENG_ATTR_FLUSH);
+}
+
+/// Simply sends a signal to the kernel module.
+/**
+* @param[in] signal   The signal to be sent.
+* \return EXIT_SUCCESS or error codes
+*/
+int send_signal (int signal) {
+    struct nl_msg *msg;
+    int err;
+
+    err = build_signal_msg(&msg, signal);
+    if (err) return err;
+
+    return send_sync(msg);
 }
 
 int send_signal_ack (int signal) {
@@ -470,3 +1010,202 @@ int flush_module(void) {
         return EXIT_FAILURE;
     }
 }
+
+int stage_begin_ack (void) {
+    return send_signal_ack(XT_SENG_ATTR_STAGE_BEGIN);
+}
+
+int stage_enclaves_batch (const struct seng_enclave_entry* entries, size_t n) {
+    return send_batches(entries, n, true);
+}
+
+/// Adds a category to an app of the staged database.
+/**
+* @param[in] app_hash   The app hash to be added to.
+* @param[in] cat_name   The category to be added.
+* \return EXIT_SUCCESS or error codes
+*/
+int stage_cat_to_app (const uint8_t* app_hash, const char* cat_name) {
+    struct nl_msg* msg;
+    int err;
+
+    err = build_cat_msg(&msg, app_hash, cat_name, XT_SENG_ATTR_ADD);
+    if (err) return err;
+
+    err = nla_put_flag(msg, XT_SENG_ATTR_STAGED);
+    if (err) {
+        fprintf(stderr, "SENG: Failed to set staged flag!\n");
+        nlmsg_free(msg);
+        return err;
+    }
+
+    return send_sync(msg);
+}
+
+int stage_cat_to_app_ack (const uint8_t* app_hash, const char* cat_name) {
+    int ret;
+    int i = 0;
+
+    repeat_msg:
+
+    if (i > 4) {
+        printf("SENG: failed sending message %i times - aborting...\n", i);
+        return -1;
+    }
+
+    //send message
+    ret = stage_cat_to_app (app_hash, cat_name);
+
+    if (ret < 0) {
+        printf("SENG: Did not send message! - %i\n", i);
+        i += 1;
+        goto repeat_msg;
+    }
+
+    return 0;
+}
+
+int stage_commit_ack (void) {
+    int ret;
+
+    ret = send_signal_ack(XT_SENG_ATTR_STAGE_COMMIT);
+
+    if (ret == EXIT_SUCCESS) {
+        printf("SENG: staged database committed successfully!\n");
+    } else {
+        printf("SENG: Error committing the staged database!\n");
+    }
+
+    return ret;
+}
+
+int stage_abort_ack (void) {
+    return send_signal_ack(XT_SENG_ATTR_STAGE_ABORT);
+}
+
+/**
+ * @brief state of a running enclave dump
+ * */
+struct dump_state {
+    seng_dump_cb cb;        ///< the callback of the caller
+    void* arg;              ///< the argument of the callback
+    int ret;                ///< first non-zero return value of the callback
+    int err;                ///< error code with which the kernel module ended the dump (negative errno)
+};
+
+/// libnl callback parsing a single dumped enclave.
+static int dump_handler (struct nl_msg* msg, void* arg) {
+    struct dump_state* state = arg;
+    struct nlattr* tb[XT_SENG_ATTR_MAX + 1];
+    struct seng_enclave_info info;
+    struct nlattr* cat;
+    int rem;
+
+    // the remaining parts of the dump still have to be consumed
+    if (state->ret) return NL_SKIP;
+
+    if (genlmsg_parse(nlmsg_hdr(msg), 0, tb, XT_SENG_ATTR_MAX, genl_seng_policy) < 0 ||
+        !tb[XT_SENG_ATTR_APP] || nla_len(tb[XT_SENG_ATTR_APP]) != SGX_HASH_SIZE) {
+        fprintf(stderr, "SENG: Malformed dump message!\n");
+        return NL_SKIP;
+    }
+
+    memset(&info, 0, offsetof(struct seng_enclave_info, cat_names));
+
+    if (tb[XT_SENG_ATTR_ENC] && tb[XT_SENG_ATTR_HOST]) {
+        info.family = AF_INET;
+        info.enclave_ip = nla_get_u32(tb[XT_SENG_ATTR_ENC]);
+        info.host = nla_get_u32(tb[XT_SENG_ATTR_HOST]);
+    } else if (tb[XT_SENG_ATTR_ENC6] && tb[XT_SENG_ATTR_HOST6] &&
+               nla_len(tb[XT_SENG_ATTR_ENC6]) == sizeof(struct in6_addr) && nla_len(tb[XT_SENG_ATTR_HOST6]) == sizeof(struct in6_addr)) {
+        info.family = AF_INET6;
+        memcpy(&info.enclave_ip6, nla_data(tb[XT_SENG_ATTR_ENC6]), sizeof(struct in6_addr));
+        memcpy(&info.host6, nla_data(tb[XT_SENG_ATTR_HOST6]), sizeof(struct in6_addr));
+    } else {
+        fprintf(stderr, "SENG: Malformed dump message!\n");
+        return NL_SKIP;
+    }
+
+    memcpy(info.app_hash, nla_data(tb[XT_SENG_ATTR_APP]), SGX_HASH_SIZE);
+    info.n_cats = 0;
+
+    if (tb[XT_SENG_ATTR_CATS]) {
+        nla_for_each_nested(cat, tb[XT_SENG_ATTR_CATS], rem) {
+            if (nla_type(cat) != XT_SENG_ATTR_CAT || info.n_cats == SENG_MAX_CATEGORIES) continue;
+            info.cat_names[info.n_cats++] = nla_get_string(cat);
+        }
+    }
+
+    state->ret = state->cb(&info, state->arg);
+
+    return NL_OK;
+}
+
+/// libnl callback reading the error code of the final message of the dump.
+static int dump_finish_handler (struct nl_msg* msg, void* arg) {
+    struct dump_state* state = arg;
+    struct nlmsghdr* nlh = nlmsg_hdr(msg);
+
+    // e.g., -EMSGSIZE if an enclave has too many categories for a single message
+    if (nlmsg_datalen(nlh) >= (int) sizeof(int)) memcpy(&state->err, nlmsg_data(nlh), sizeof(int));
+    if (state->err > 0) state->err = 0;
+
+    return NL_STOP;
+}
+
+int set_conntrack_flush_mode (enum seng_ct_flush_mode mode) {
+    if (mode != SENG_CT_FLUSH_KERNEL && mode != SENG_CT_FLUSH_USER) return EXIT_FAILURE;
+
+    ct_flush_mode = mode;
+    return EXIT_SUCCESS;
+}
+
+int dump_enclaves (seng_dump_cb cb, void* arg) {
+    struct dump_state state = { .cb = cb, .arg = arg, .ret = 0, .err = 0 };
+    struct nl_msg* msg;
+    struct nl_cb* ncb;
+    int family_id;
+    int err;
+
+    family_id = get_family_id();
+    if(family_id < 0){
+        fprintf(stderr, "SENG: Unable to resolve family name!\n");
+        return -1;
+    }
+
+    msg = nlmsg_alloc();
+    if (!msg) {
+        fprintf(stderr, "SENG: Failed to allocate netlink message\n");
+        return -ENOMEM;
+    }
+
+    if(!genlmsg_put(msg, NL_AUTO_PID, NL_AUTO_SEQ, family_id, 0, NLM_F_REQUEST | NLM_F_DUMP, GENL_XT_SENG_DUMP, 0)) {
+        fprintf(stderr, "SENG: Failed to put nl_hdr!\n");
+        nlmsg_free(msg);
+        return -ENOMEM;
+    }
+
+    ncb = nl_cb_clone(nl_socket_get_cb(nlsock));
+    if (!ncb) {
+        nlmsg_free(msg);
+        return -ENOMEM;
+    }
+    nl_cb_set(ncb, NL_CB_VALID, NL_CB_CUSTOM, dump_handler, &state);
+    nl_cb_set(ncb, NL_CB_FINISH, NL_CB_CUSTOM, dump_finish_handler, &state);
+
+    err = nl_send_auto(nlsock, msg);
+    nlmsg_free(msg);
+
+    if (err >= 0) err = nl_recvmsgs(nlsock, ncb);
+    nl_cb_put(ncb);
+
+    if (err >= 0 && state.err < 0) err = -nl_syserr2nlerr(-state.err);
+
+    if (err < 0) {
+        fprintf(stderr, "SENG: Failed to dump enclaves! (%s)\n", nl_geterror(err));
+        if (err == -NLE_OBJ_NOTFOUND) seng_family_id = -1;
+        return err;
+    }
+
+    return state.ret;
+}
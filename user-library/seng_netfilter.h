@@ -15,6 +15,150 @@
  * */
 extern struct nl_sock* nlsock;
 
+/**
+ * @brief how conntrack entries of removed enclaves are deleted
+ *
+ * Set by set_conntrack_flush_mode(), SENG_CT_FLUSH_KERNEL by default.
+ * */
+extern enum seng_ct_flush_mode ct_flush_mode;
+
+/**
+ * @def SENG_BATCH_MSG_SIZE
+ * @brief size of the netlink messages used for batches
+ *
+ * Fits SENG_BATCH_MAX_ENTRIES enclave entries with maximum category name length.
+ * */
+#define SENG_BATCH_MSG_SIZE 16384
+
+/**
+ * @def SENG_ASYNC_RCVBUF_SIZE
+ * @brief receive buffer size of the asynchronous socket
+ *
+ * ACKs of operations in flight queue up in the receive buffer until seng_async_process() is called.
+ * */
+#define SENG_ASYNC_RCVBUF_SIZE (1 << 20)
+
+/**
+ * @def SENG_EVENTS_RCVBUF_SIZE
+ * @brief receive buffer size of the event socket
+ *
+ * Events queue up in the receive buffer until seng_events_process() is called.
+ * */
+#define SENG_EVENTS_RCVBUF_SIZE (1 << 20)
+
+/**
+ * @brief Builds the message for adding an enclave.
+ *
+ * The message builders are shared by the synchronous and the asynchronous API.
+ * All of them resolve the family id via nlsock and therefore require prep_nl_sock().
+ *
+ * @param[out] msgp        The built message. (to be freed by the caller or by sending it)
+ * @param[in]  enclave     The enclave to be added.
+ * @param[in]  app_hash    The app hash associated with the enclave.
+ * @param[in]  host        The host ip associated with the enclave.
+ * @param[in]  cat_name    A category associated with the app. (optional)
+ *
+ * @return EXIT_SUCCESS or error codes
+*/
+int build_add_enclave_msg (struct nl_msg** msgp, uint32_t enclave, const uint8_t* app_hash, uint32_t host, const char* cat_name);
+
+/**
+ * @brief Builds a batch message for adding up to SENG_BATCH_MAX_ENTRIES enclaves.
+ *
+ * @param[out] msgp      The built message.
+ * @param[in]  entries   The enclaves to be added.
+ * @param[in]  n         The amount of enclaves.
+ *
+ * @return EXIT_SUCCESS or error codes
+*/
+int build_batch_msg (struct nl_msg** msgp, const struct seng_enclave_entry* entries, size_t n);
+
+/**
+ * @brief Builds the message for adding (op = XT_SENG_ATTR_ADD) or removing (op = XT_SENG_ATTR_RMV) a category of an app.
+ *
+ * @param[out] msgp       The built message.
+ * @param[in]  app_hash   The app hash.
+ * @param[in]  cat_name   The category.
+ * @param[in]  op         The operation flag.
+ *
+ * @return EXIT_SUCCESS or error codes
+*/
+int build_cat_msg (struct nl_msg** msgp, const uint8_t* app_hash, const char* cat_name, int op);
+
+/**
+ * @brief Builds the message for removing an enclave.
+ *
+ * @param[out] msgp      The built message.
+ * @param[in]  enclave   The enclave to be removed.
+ *
+ * @return EXIT_SUCCESS or error codes
+*/
+int build_remove_enclave_msg (struct nl_msg** msgp, uint32_t enclave);
+
+/**
+ * @brief Builds the message for adding an ipv6 enclave.
+ *
+ * @param[out] msgp        The built message.
+ * @param[in]  enclave     The enclave to be added.
+ * @param[in]  app_hash    The app hash associated with the enclave.
+ * @param[in]  host        The host ip associated with the enclave.
+ * @param[in]  cat_name    A category associated with the app. (optional)
+ *
+ * @return EXIT_SUCCESS or error codes
+*/
+int build_add_enclave6_msg (struct nl_msg** msgp, const struct in6_addr* enclave, const uint8_t* app_hash, const struct in6_addr* host, const char* cat_name);
+
+/**
+ * @brief Builds the message for removing an ipv6 enclave.
+ *
+ * Always lets the kernel module delete the conntrack entries of the enclave.
+ *
+ * @param[out] msgp      The built message.
+ * @param[in]  enclave   The enclave to be removed.
+ *
+ * @return EXIT_SUCCESS or error codes
+*/
+int build_remove_enclave6_msg (struct nl_msg** msgp, const struct in6_addr* enclave);
+
+/**
+ * @brief Builds the message for enabling (op = XT_SENG_ATTR_ADD) or disabling (op = XT_SENG_ATTR_RMV) subnet mode.
+ *
+ * @param[out] msgp         The built message.
+ * @param[in]  subnet       The enclave subnet base address. (network byte order)
+ * @param[in]  prefix_len   The enclave subnet prefix length. (ignored for XT_SENG_ATTR_RMV)
+ * @param[in]  op           The operation flag.
+ *
+ * @return EXIT_SUCCESS or error codes
+*/
+int build_subnet_msg (struct nl_msg** msgp, uint32_t subnet, uint32_t prefix_len, int op);
+
+/**
+ * @brief Builds the message for an operation on the policy map.
+ *
+ * Adds/replaces (op = XT_SENG_ATTR_ADD) or removes (op = XT_SENG_ATTR_RMV) the entry of an app or a category,
+ * or removes all entries (op = XT_SENG_ATTR_FLUSH, without app hash and category).
+ *
+ * @param[out] msgp         The built message.
+ * @param[in]  app_hash     The app hash of an app entry. (or NULL)
+ * @param[in]  cat_name     The category name of a category entry. (or NULL)
+ * @param[in]  verdict      The verdict. (enum seng_policy_verdict, ignored unless XT_SENG_ATTR_ADD)
+ * @param[in]  mark         The packet mark. (ignored unless XT_SENG_ATTR_ADD, may be NULL)
+ * @param[in]  op           The operation flag.
+ *
+ * @return EXIT_SUCCESS or error codes
+*/
+int build_policy_msg (struct nl_msg** msgp, const uint8_t* app_hash, const char* cat_name, uint32_t verdict, const uint32_t* mark, int op);
+
+/**
+ * @brief Builds a signal message.
+ *
+ * @param[out] msgp     The built message.
+ * @param[in]  signal   The signal flag.
+ *
+ * @return EXIT_SUCCESS or error codes
+*/
+int build_signal_msg (struct nl_msg** msgp, int signal);
+
 /**
  * @brief Sends a signal to the kernel module with retrial mechanism.
  *
@@ -29,7 +173,7 @@ int send_signal_ack (int signal);
 /**
  * @brief Deletes all conntrack entries associated with the given enclave.
  *
- * Dumps all conntrack entries and deletes those matching the source or destination ipv4.
+ * Dumps the conntrack entries (filtered by the kernel, if supported) and deletes those matching the source or destination ipv4.
  *
  * @param[in] pEnclave_ip   The enclave, whose entries are to be deleted. (network byte order)
  *
@@ -37,4 +181,18 @@ int send_signal_ack (int signal);
 */
 int delete_conntrack_entries (uint32_t pEnclave_ip);
 
+/**
+ * @brief Opens the conntrack handles used by delete_conntrack_entries().
+ *
+ * Called once by prep_nl_sock(), such that removals do not open sockets. Does nothing if already open.
+ *
+ * @return 0 or -1 on error
+*/
+int open_conntrack_handles (void);
+
+/**
+ * @brief Closes the conntrack handles used by delete_conntrack_entries().
+*/
+void close_conntrack_handles (void);
+
 #endif